@@ -44,13 +44,34 @@ int main(int argc, char **argv)
     // command line that you want to execute.
     Nob_Cmd cmd = {0};
 
+    // `./nob portable` builds for the baseline instruction set instead of the build machine's, so
+    // the SIMD paths fall back to SSE or plain scalar code. `./nob bench` also builds the vec3
+    // benchmark, once with the SIMD vec3 and once with the scalar fallback.
+    const char *program = nob_shift(argv, argc);
+    (void) program;
+    bool portable = false;
+    bool bench = false;
+    while (argc > 0) {
+        const char *arg = nob_shift(argv, argc);
+        if (strcmp(arg, "portable") == 0) portable = true;
+        else if (strcmp(arg, "bench") == 0) bench = true;
+        else {
+            nob_log(NOB_ERROR, "unknown argument `%s`; expected `portable` or `bench`", arg);
+            return 1;
+        }
+    }
+
     // Let's append the command line arguments
 #if !defined(_MSC_VER)
     // On POSIX
-    nob_cmd_append(&cmd, "g++", "-Wall", "-Wextra", "-o", BUILD_FOLDER"main", SRC_FOLDER"main.cpp");
+    nob_cmd_append(&cmd, "g++", "-Wall", "-Wextra", "-O3", "-pthread");
+    if (!portable) nob_cmd_append(&cmd, "-march=native");
+    nob_cmd_append(&cmd, "-o", BUILD_FOLDER"main", SRC_FOLDER"main.cpp");
 #else
     // On MSVC
-    nob_cmd_append(&cmd, "cl", "-I.", "-o", BUILD_FOLDER"main", SRC_FOLDER"main.cpp");
+    nob_cmd_append(&cmd, "cl", "-I.", "-O2", "-std:c++17");
+    if (!portable) nob_cmd_append(&cmd, "-arch:AVX2");
+    nob_cmd_append(&cmd, "-o", BUILD_FOLDER"main", SRC_FOLDER"main.cpp");
 #endif // _MSC_VER
 
     // Let's execute the command.
@@ -58,5 +79,29 @@ int main(int argc, char **argv)
     // nob_cmd_run() automatically resets the cmd array, so you can nob_cmd_append() more strings
     // into it.
 
+    if (bench) {
+#if !defined(_MSC_VER)
+        nob_cmd_append(&cmd, "g++", "-Wall", "-Wextra", "-O3");
+        if (!portable) nob_cmd_append(&cmd, "-march=native");
+        nob_cmd_append(&cmd, "-o", BUILD_FOLDER"bench_vec3", SRC_FOLDER"bench_vec3.cpp");
+        if (!nob_cmd_run(&cmd)) return 1;
+
+        nob_cmd_append(&cmd, "g++", "-Wall", "-Wextra", "-O3", "-DRT_VEC3_SCALAR");
+        if (!portable) nob_cmd_append(&cmd, "-march=native");
+        nob_cmd_append(&cmd, "-o", BUILD_FOLDER"bench_vec3_scalar", SRC_FOLDER"bench_vec3.cpp");
+        if (!nob_cmd_run(&cmd)) return 1;
+#else
+        nob_cmd_append(&cmd, "cl", "-I.", "-O2", "-std:c++17");
+        if (!portable) nob_cmd_append(&cmd, "-arch:AVX2");
+        nob_cmd_append(&cmd, "-o", BUILD_FOLDER"bench_vec3", SRC_FOLDER"bench_vec3.cpp");
+        if (!nob_cmd_run(&cmd)) return 1;
+
+        nob_cmd_append(&cmd, "cl", "-I.", "-O2", "-std:c++17", "-DRT_VEC3_SCALAR");
+        if (!portable) nob_cmd_append(&cmd, "-arch:AVX2");
+        nob_cmd_append(&cmd, "-o", BUILD_FOLDER"bench_vec3_scalar", SRC_FOLDER"bench_vec3.cpp");
+        if (!nob_cmd_run(&cmd)) return 1;
+#endif // _MSC_VER
+    }
+
     return 0;
 }
\ No newline at end of file
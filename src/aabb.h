@@ -3,6 +3,31 @@
 
 #include "rtweekend.h"
 
+#include <cmath>
+#include <limits>
+
+// The float slab tests of the BVHs and ray packets work on float copies of double-precision
+// geometry. Boxes are rounded outwards, so they still enclose the boxes they came from.
+inline float float_round_down(double value)
+{
+    float rounded = float(value);
+    return (double(rounded) > value) ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+}
+
+inline float float_round_up(double value)
+{
+    float rounded = float(value);
+    return (double(rounded) < value) ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+}
+
+// Upper bound on how far a double moved when it was rounded to the float value: an ulp of value,
+// and never less than the smallest normal float. Ray origins are widened by it, since rounding
+// them per ray with the functions above would cost more than the traversal saves.
+inline float float_rounding_error(float value)
+{
+    return std::fabs(value) * std::numeric_limits<float>::epsilon() + std::numeric_limits<float>::min();
+}
+
 class aabb
 {
     public:
@@ -37,37 +62,12 @@ class aabb
             return x;
         }
 
-        bool hit(const ray& r, interval ray_t) const
+        double surface_area() const
         {
-            const point3& ray_origin = r.get_origin();
-            const vec3& ray_direction = r.get_direction();
-
-            for (int axis = 0; axis < 3; axis++)
-            {
-                const interval& ax = axis_interval(axis);
-                const double adinv = 1.0 / ray_direction[axis];
-
-                auto t0 = (ax.min - ray_origin[axis]) * adinv;
-                auto t1 = (ax.max - ray_origin[axis]) * adinv;
-
-                if (t0 < t1)
-                {
-                    if (t0 > ray_t.min) ray_t.min = t0;
-                    if (t1 < ray_t.max) ray_t.max = t1;
-                }
-                else
-                {
-                    if (t1 > ray_t.min) ray_t.min = t1;
-                    if (t0 < ray_t.max) ray_t.max = t0;
-                }
-
-                if (ray_t.max <= ray_t.min)
-                {
-                    return false;
-                }
-            }
-
-            return true;
+            auto dx = x.size();
+            auto dy = y.size();
+            auto dz = z.size();
+            return 2 * (dx * dy + dy * dz + dz * dx);
         }
 
         int longest_axis() const
@@ -83,6 +83,13 @@ class aabb
         }
         
         static const aabb empty, universe;
+
+        // 1 + 2 * gamma(3): bound on the relative rounding error of a slab distance. The BVH node
+        // tests scale each far distance by it, so rounding never culls a box a ray grazes.
+        static constexpr double far_scale = 1 + 2 * (3 * std::numeric_limits<double>::epsilon() / 2);
+
+        // The same for the float slab tests, with a whole epsilon per rounding for margin
+        static constexpr float float_far_scale = 1 + 2 * (3 * std::numeric_limits<float>::epsilon());
 };
 
 const aabb aabb::empty    = aabb(interval::empty,    interval::empty,    interval::empty);
@@ -0,0 +1,106 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic bump allocator. Objects are carved one after another out of large blocks and are
+// never freed individually: the whole arena is released at once, by reset() or on destruction.
+// Nothing allocated from it is ever destroyed, so only trivially destructible types may live in
+// it. Allocation is safe from several threads at once (e.g. a parallel BVH build).
+class arena
+{
+    public:
+        static constexpr size_t default_block_size = size_t(64) << 10;
+
+        explicit arena(size_t block_size = default_block_size) : block_size(block_size) {}
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        void* allocate(size_t size, size_t alignment)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            size_t offset = aligned_offset(alignment);
+            if (blocks.empty() || offset + size > capacity)
+            {
+                // Oversized requests get a block of their own
+                add_block(std::max(block_size, size + alignment));
+                offset = aligned_offset(alignment);
+            }
+
+            used = offset + size;
+            total += size;
+            return current + offset;
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args)
+        {
+            static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // Release everything at once. The first block is kept, so an arena reused for job after
+        // job stops touching the heap.
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (blocks.size() > 1)
+            {
+                blocks.erase(blocks.begin() + 1, blocks.end());
+            }
+            current = blocks.empty() ? nullptr : blocks.front().data.get();
+            capacity = blocks.empty() ? 0 : blocks.front().size;
+            used = 0;
+            total = 0;
+        }
+
+        // Bytes handed out since construction or the last reset
+        size_t bytes_used() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return total;
+        }
+
+    private:
+        struct block
+        {
+            std::unique_ptr<std::byte[]> data;
+            size_t size;
+        };
+
+        size_t block_size;
+        std::vector<block> blocks;
+        std::byte* current = nullptr;
+        size_t capacity = 0;    // Size of the current block
+        size_t used = 0;        // Bytes used in the current block
+        size_t total = 0;
+        mutable std::mutex mutex;
+
+        // Offset of the next address in the current block with the given (power of two) alignment
+        size_t aligned_offset(size_t alignment) const
+        {
+            uintptr_t address = reinterpret_cast<uintptr_t>(current) + used;
+            uintptr_t aligned = (address + alignment - 1) & ~uintptr_t(alignment - 1);
+            return used + size_t(aligned - address);
+        }
+
+        void add_block(size_t size)
+        {
+            blocks.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+            current = blocks.back().data.get();
+            capacity = size;
+            used = 0;
+        }
+};
+
+#endif
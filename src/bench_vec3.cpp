@@ -0,0 +1,161 @@
+// Micro-benchmark for the vec3 operations used by scattering and camera ray generation.
+//
+// `./nob bench` builds it twice: build/bench_vec3 with the SIMD vec3 and build/bench_vec3_scalar
+// with RT_VEC3_SCALAR, which forces the portable code. Run both and compare the ns/op columns.
+
+#include "rtweekend.h"
+
+#include "sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static const size_t vector_count = 4096;
+static const int repetitions = 400;
+static const int trials = 7;
+
+// Keeps results alive so the compiler cannot drop the work being timed
+static double checksum = 0;
+
+// Time body() over vector_count vectors and report the fastest of several trials, which is the
+// one least disturbed by the rest of the machine
+template <typename Body>
+void run(const char* name, const Body& body)
+{
+    body(); // Warm up caches and branch predictors
+
+    double best = infinity;
+    for (int trial = 0; trial < trials; trial++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int repetition = 0; repetition < repetitions; repetition++)
+        {
+            body();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    double operations = double(vector_count) * repetitions;
+    std::printf("  %-22s %8.3f ns/op\n", name, best * 1e9 / operations);
+}
+
+int main()
+{
+#if defined(RT_VEC3_AVX)
+    std::printf("vec3: AVX, %zu bytes\n", sizeof(vec3));
+#else
+    std::printf("vec3: scalar, %zu bytes\n", sizeof(vec3));
+#endif
+
+    sampler rng(1);
+    std::vector<vec3> a(vector_count), b(vector_count), normals(vector_count), out(vector_count);
+    std::vector<double> scalars(vector_count);
+    for (size_t i = 0; i < vector_count; i++)
+    {
+        a[i] = rng.random_vec3(-1, 1);
+        b[i] = rng.random_vec3(-1, 1);
+        normals[i] = rng.random_unit_vector();
+        scalars[i] = rng.random_double(0.5, 2);
+    }
+
+    std::printf("Single operations:\n");
+
+    run("add", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = a[i] + b[i];
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("scale", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = scalars[i] * a[i];
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("dot", [&]()
+    {
+        double sum = 0;
+        for (size_t i = 0; i < vector_count; i++) sum += dot(a[i], b[i]);
+        checksum += sum;
+    });
+
+    run("cross", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = cross(a[i], b[i]);
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("unit_vector", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = unit_vector(a[i]);
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("reflect", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = reflect(a[i], normals[i]);
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("refract", [&]()
+    {
+        for (size_t i = 0; i < vector_count; i++) out[i] = refract(unit_vector(a[i]), normals[i], 1 / 1.5);
+        checksum += out[vector_count / 2][0];
+    });
+
+    std::printf("Kernels:\n");
+
+    // The direction math of lambertian and metal scatter, with the sampler's random vectors
+    run("lambertian scatter", [&]()
+    {
+        sampler scatter_rng(2);
+        for (size_t i = 0; i < vector_count; i++)
+        {
+            vec3 direction = normals[i] + scatter_rng.random_unit_vector();
+            out[i] = direction.near_zero() ? normals[i] : direction;
+        }
+        checksum += out[vector_count / 2][0];
+    });
+
+    run("metal scatter", [&]()
+    {
+        sampler scatter_rng(3);
+        for (size_t i = 0; i < vector_count; i++)
+        {
+            vec3 reflected = unit_vector(reflect(a[i], normals[i])) + (0.3 * scatter_rng.random_unit_vector());
+            out[i] = (dot(reflected, normals[i]) > 0) ? reflected : vec3();
+        }
+        checksum += out[vector_count / 2][0];
+    });
+
+    // camera::get_ray: jittered pixel position plus a defocus disk sample
+    point3 camera_center(13, 2, 3);
+    point3 pixel00_location(-3.2, 1.8, -1);
+    vec3 pixel_delta_x(0.01, 0, -0.002);
+    vec3 pixel_delta_y(0, -0.01, 0.001);
+    vec3 defocus_disk_x(0.05, 0, 0.01);
+    vec3 defocus_disk_y(0, 0.05, 0.002);
+
+    run("camera ray generation", [&]()
+    {
+        sampler camera_rng(4);
+        for (size_t i = 0; i < vector_count; i++)
+        {
+            auto offset = camera_rng.random_in_unit_square();
+            auto pixel_sample = pixel00_location
+                              + ((double(i % 64) + offset[0]) * pixel_delta_x)
+                              + ((double(i / 64) + offset[1]) * pixel_delta_y);
+            auto disk = camera_rng.random_in_unit_disk();
+            point3 origin = camera_center + (disk[0] * defocus_disk_x) + (disk[1] * defocus_disk_y);
+            ray r(origin, pixel_sample - origin, camera_rng.random_double());
+            out[i] = r.get_inverse_direction();
+        }
+        checksum += out[vector_count / 2][0];
+    });
+
+    std::printf("(checksum %g)\n", checksum);
+    return 0;
+}
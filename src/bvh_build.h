@@ -0,0 +1,471 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "aabb.h"
+#include "arena.h"
+#include "rtweekend.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+enum class bvh_split_method
+{
+    median,     // Halve the primitives at the centroid median of the longest axis
+    sah         // Binned surface area heuristic
+};
+
+struct bvh_build_options
+{
+    bvh_split_method split_method = bvh_split_method::sah;
+    int bin_count = 16;             // SAH candidate planes per axis are bin_count - 1
+    int max_leaf_size = 4;          // Spans larger than this are always split
+    double traversal_cost = 1.0;    // Cost of visiting a node relative to one primitive test
+};
+
+// Binary tree produced by bvh_builder. The compact layouts used for traversal (linear_bvh,
+// wide_bvh) are flattened or collapsed from it. Nodes live in an arena and are trivially
+// destructible, so the whole tree is thrown away in one go once it has been flattened.
+struct bvh_build_node
+{
+    aabb box;
+    bvh_build_node* children[2] = {nullptr, nullptr};
+    size_t first = 0;       // Leaf: first entry of bvh_build_result::primitive_order
+    size_t count = 0;       // Leaf: number of primitives. 0 for interior nodes.
+    int axis = 0;           // Interior: split axis
+
+    bool is_leaf() const
+    {
+        return count > 0;
+    }
+};
+
+struct bvh_build_result
+{
+    const bvh_build_node* root = nullptr;   // Owned by the arena passed to bvh_builder::build
+    std::vector<size_t> primitive_order;    // Input indices in leaf order
+    size_t node_count = 0;
+};
+
+// Top-down BVH builder over a set of primitive bounding boxes. With a thread pool, subtrees above
+// parallel_subtree_threshold primitives are built as separate tasks, and the bounds, SAH binning
+// and partitioning of spans above parallel_span_threshold are split into chunks across the pool.
+class bvh_builder
+{
+    public:
+        static constexpr int max_depth = 64;
+        static constexpr size_t max_leaf_count = std::numeric_limits<uint16_t>::max();
+        static constexpr size_t parallel_subtree_threshold = 1024;
+        static constexpr size_t parallel_span_threshold = 1 << 16;
+        static constexpr size_t parallel_chunk_size = 1 << 14;
+
+        bvh_builder(const bvh_build_options& build_options, thread_pool* pool = nullptr)
+            : options(build_options), pool(pool)
+        {
+            options.bin_count = std::max(2, options.bin_count);
+            options.max_leaf_size = std::clamp(options.max_leaf_size, 1, int(max_leaf_count));
+        }
+
+        // Nodes are allocated from node_arena, which must outlive the result
+        bvh_build_result build(const std::vector<aabb>& boxes, arena& node_arena)
+        {
+            nodes = &node_arena;
+            build_primitives.clear();
+            build_primitives.resize(boxes.size());
+            for_each_chunk(0, boxes.size(), [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    build_primitives[i] = {boxes[i], centroid(boxes[i]), i};
+                }
+            });
+
+            bvh_build_result result;
+            node_count = 0;
+            if (!build_primitives.empty())
+            {
+                result.root = build_subtree(0, build_primitives.size(), 0);
+            }
+
+            result.primitive_order.resize(build_primitives.size());
+            for (size_t i = 0; i < build_primitives.size(); i++)
+            {
+                result.primitive_order[i] = build_primitives[i].object_index;
+            }
+            result.node_count = node_count.load();
+            return result;
+        }
+
+    private:
+        struct build_primitive
+        {
+            aabb box;
+            point3 center;
+            size_t object_index;
+        };
+
+        struct split_bin
+        {
+            aabb box = aabb::empty;
+            size_t count = 0;
+        };
+
+        // Bins for all three axes of one span, laid out axis-major
+        using bin_set = std::vector<split_bin>;
+
+        bvh_build_options options;
+        thread_pool* pool;
+        arena* nodes = nullptr;
+        std::vector<build_primitive> build_primitives;
+        std::atomic<size_t> node_count{0};
+
+        static point3 centroid(const aabb& box)
+        {
+            return point3(0.5 * (box.x.min + box.x.max),
+                          0.5 * (box.y.min + box.y.max),
+                          0.5 * (box.z.min + box.z.max));
+        }
+
+        bool parallel_span(size_t start, size_t end) const
+        {
+            return pool && end - start >= parallel_span_threshold;
+        }
+
+        // Call body(begin, end) over [start, end) in chunks, on the pool when the span is large
+        template <typename Body>
+        void for_each_chunk(size_t start, size_t end, const Body& body) const
+        {
+            if (!parallel_span(start, end))
+            {
+                body(start, end);
+                return;
+            }
+
+            size_t chunk_count = (end - start + parallel_chunk_size - 1) / parallel_chunk_size;
+            parallel_for(*pool, chunk_count, [&](size_t chunk)
+            {
+                size_t begin = start + chunk * parallel_chunk_size;
+                body(begin, std::min(end, begin + parallel_chunk_size));
+            });
+        }
+
+        size_t chunk_count(size_t start, size_t end) const
+        {
+            return parallel_span(start, end) ? (end - start + parallel_chunk_size - 1) / parallel_chunk_size : 1;
+        }
+
+        size_t chunk_begin(size_t start, size_t end, size_t chunk) const
+        {
+            return parallel_span(start, end) ? start + chunk * parallel_chunk_size : start;
+        }
+
+        void compute_bounds(size_t start, size_t end, aabb& node_box, aabb& centroid_box) const
+        {
+            size_t chunks = chunk_count(start, end);
+            std::vector<aabb> chunk_boxes(chunks, aabb::empty);
+            std::vector<aabb> chunk_centroids(chunks, aabb::empty);
+
+            for_each_chunk(start, end, [&](size_t begin, size_t chunk_end)
+            {
+                size_t chunk = (begin - start) / parallel_chunk_size;
+                aabb box = aabb::empty;
+                aabb centroids = aabb::empty;
+                for (size_t i = begin; i < chunk_end; i++)
+                {
+                    box = aabb(box, build_primitives[i].box);
+                    centroids = aabb(centroids, aabb(build_primitives[i].center, build_primitives[i].center));
+                }
+                chunk_boxes[chunk] = box;
+                chunk_centroids[chunk] = centroids;
+            });
+
+            node_box = aabb::empty;
+            centroid_box = aabb::empty;
+            for (size_t chunk = 0; chunk < chunks; chunk++)
+            {
+                node_box = aabb(node_box, chunk_boxes[chunk]);
+                centroid_box = aabb(centroid_box, chunk_centroids[chunk]);
+            }
+        }
+
+        int bin_index(const build_primitive& primitive, int axis, const aabb& centroid_box) const
+        {
+            const interval& extent = centroid_box.axis_interval(axis);
+            int bin = int((primitive.center[axis] - extent.min) * (options.bin_count / extent.size()));
+            return std::min(options.bin_count - 1, bin);
+        }
+
+        bin_set fill_bins(size_t start, size_t end, const aabb& centroid_box) const
+        {
+            int bin_count = options.bin_count;
+            size_t chunks = chunk_count(start, end);
+            std::vector<bin_set> chunk_bins(chunks, bin_set(3 * bin_count));
+
+            for_each_chunk(start, end, [&](size_t begin, size_t chunk_end)
+            {
+                bin_set& bins = chunk_bins[(begin - start) / parallel_chunk_size];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (centroid_box.axis_interval(axis).size() <= 0)
+                    {
+                        continue;
+                    }
+
+                    for (size_t i = begin; i < chunk_end; i++)
+                    {
+                        auto& bin = bins[axis * bin_count + bin_index(build_primitives[i], axis, centroid_box)];
+                        bin.box = aabb(bin.box, build_primitives[i].box);
+                        bin.count++;
+                    }
+                }
+            });
+
+            for (size_t chunk = 1; chunk < chunks; chunk++)
+            {
+                for (int bin = 0; bin < 3 * bin_count; bin++)
+                {
+                    chunk_bins[0][bin].box = aabb(chunk_bins[0][bin].box, chunk_bins[chunk][bin].box);
+                    chunk_bins[0][bin].count += chunk_bins[chunk][bin].count;
+                }
+            }
+            return std::move(chunk_bins[0]);
+        }
+
+        // Stable-per-chunk partition of [start, end): each chunk partitions in place, then the
+        // chunks' left and right runs are scattered into their final places through a scratch
+        // buffer. Returns the split point.
+        template <typename Predicate>
+        size_t partition(size_t start, size_t end, const Predicate& goes_left)
+        {
+            auto first = build_primitives.begin();
+            if (!parallel_span(start, end))
+            {
+                return size_t(std::partition(first + start, first + end, goes_left) - first);
+            }
+
+            size_t chunks = chunk_count(start, end);
+            std::vector<size_t> left_counts(chunks);
+            for_each_chunk(start, end, [&](size_t begin, size_t chunk_end)
+            {
+                auto split = std::partition(first + begin, first + chunk_end, goes_left);
+                left_counts[(begin - start) / parallel_chunk_size] = size_t(split - (first + begin));
+            });
+
+            size_t total_left = 0;
+            for (size_t count : left_counts) total_left += count;
+
+            std::vector<size_t> left_offsets(chunks);
+            std::vector<size_t> right_offsets(chunks);
+            size_t left_offset = 0;
+            size_t right_offset = total_left;
+            for (size_t chunk = 0; chunk < chunks; chunk++)
+            {
+                size_t begin = chunk_begin(start, end, chunk);
+                size_t chunk_size = std::min(end, begin + parallel_chunk_size) - begin;
+                left_offsets[chunk] = left_offset;
+                right_offsets[chunk] = right_offset;
+                left_offset += left_counts[chunk];
+                right_offset += chunk_size - left_counts[chunk];
+            }
+
+            std::vector<build_primitive> scratch(end - start);
+            for_each_chunk(start, end, [&](size_t begin, size_t chunk_end)
+            {
+                size_t chunk = (begin - start) / parallel_chunk_size;
+                size_t split = begin + left_counts[chunk];
+                std::copy(first + begin, first + split, scratch.begin() + left_offsets[chunk]);
+                std::copy(first + split, first + chunk_end, scratch.begin() + right_offsets[chunk]);
+            });
+
+            for_each_chunk(start, end, [&](size_t begin, size_t chunk_end)
+            {
+                std::copy(scratch.begin() + (begin - start), scratch.begin() + (chunk_end - start), first + begin);
+            });
+
+            return start + total_left;
+        }
+
+        // Levels of median splits needed before every piece of a span fits in one leaf
+        static int median_levels(size_t object_span)
+        {
+            int levels = 0;
+            while (object_span > max_leaf_count)
+            {
+                object_span = (object_span + 1) / 2;
+                levels++;
+            }
+            return levels;
+        }
+
+        // Partition [start, end) at the centroid median along axis and return the split point.
+        size_t split_median(size_t start, size_t end, int axis)
+        {
+            size_t mid = start + (end - start) / 2;
+            std::nth_element(build_primitives.begin() + start, build_primitives.begin() + mid,
+                             build_primitives.begin() + end,
+                             [axis](const build_primitive& a, const build_primitive& b)
+                             {
+                                 return a.center[axis] < b.center[axis];
+                             });
+            return mid;
+        }
+
+        // Binned SAH: drop every centroid into one of bin_count equal slabs on each axis, sweep the
+        // bins once from each side to get the area and count on both sides of every bin boundary,
+        // and take the cheapest boundary over all three axes. Returns false when a leaf is
+        // cheaper; otherwise partitions the span and sets the split axis and point.
+        bool split_sah(size_t start, size_t end, const aabb& node_box, const aabb& centroid_box,
+                       bool must_split, int& split_axis, size_t& mid)
+        {
+            int bin_count = options.bin_count;
+            size_t object_span = end - start;
+            double node_area = node_box.surface_area();
+
+            double best_cost = infinity;
+            int best_axis = -1;
+            int best_boundary = 0;
+
+            bin_set bins = fill_bins(start, end, centroid_box);
+            std::vector<double> right_area(bin_count);
+            std::vector<size_t> right_count(bin_count);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (centroid_box.axis_interval(axis).size() <= 0)
+                {
+                    continue;
+                }
+
+                const split_bin* axis_bins = &bins[axis * bin_count];
+
+                // right_area[b] / right_count[b] describe bins [b, bin_count)
+                aabb right_box = aabb::empty;
+                size_t count = 0;
+                for (int bin = bin_count - 1; bin > 0; bin--)
+                {
+                    right_box = aabb(right_box, axis_bins[bin].box);
+                    count += axis_bins[bin].count;
+                    right_area[bin] = right_box.surface_area();
+                    right_count[bin] = count;
+                }
+
+                aabb left_box = aabb::empty;
+                count = 0;
+                for (int boundary = 1; boundary < bin_count; boundary++)
+                {
+                    left_box = aabb(left_box, axis_bins[boundary - 1].box);
+                    count += axis_bins[boundary - 1].count;
+                    if (count == 0 || right_count[boundary] == 0)
+                    {
+                        continue;
+                    }
+
+                    double cost = options.traversal_cost
+                                + (count * left_box.surface_area() + right_count[boundary] * right_area[boundary]) / node_area;
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_boundary = boundary;
+                    }
+                }
+            }
+
+            if (best_axis < 0)
+            {
+                // Centroids collapse to a point on every axis that was binned
+                if (!must_split && object_span <= size_t(options.max_leaf_size))
+                {
+                    return false;
+                }
+                split_axis = centroid_box.longest_axis();
+                mid = split_median(start, end, split_axis);
+                return true;
+            }
+
+            if (!must_split && object_span <= size_t(options.max_leaf_size) && best_cost >= double(object_span))
+            {
+                return false;
+            }
+
+            split_axis = best_axis;
+            mid = partition(start, end, [&](const build_primitive& primitive)
+            {
+                return bin_index(primitive, best_axis, centroid_box) < best_boundary;
+            });
+            return true;
+        }
+
+        bvh_build_node* build_subtree(size_t start, size_t end, int depth)
+        {
+            bvh_build_node* node = nodes -> make<bvh_build_node>();
+            node_count++;
+
+            aabb centroid_box;
+            compute_bounds(start, end, node -> box, centroid_box);
+
+            size_t object_span = end - start;
+            int axis = centroid_box.longest_axis();
+            size_t mid = start;
+
+            // Make a leaf when the span is small enough, all centroids coincide, the depth limit
+            // is reached, or the SAH says splitting costs more than testing every primitive.
+            bool must_split = object_span > max_leaf_count;
+            bool make_leaf = object_span == 1
+                          || (!must_split && centroid_box.axis_interval(axis).size() <= 0)
+                          || (!must_split && depth + 1 >= max_depth);
+
+            // A span too large for one leaf near the depth limit is halved from here on, so the
+            // tree never outgrows the traversal stacks however lopsided the SAH splits above were
+            bool force_median = must_split && depth + 1 + median_levels(object_span) >= max_depth;
+
+            if (!make_leaf)
+            {
+                if (force_median)
+                {
+                    mid = split_median(start, end, axis);
+                }
+                else if (options.split_method == bvh_split_method::sah)
+                {
+                    make_leaf = !split_sah(start, end, node -> box, centroid_box, must_split, axis, mid);
+                }
+                else if (object_span <= size_t(options.max_leaf_size))
+                {
+                    make_leaf = true;
+                }
+                else
+                {
+                    mid = split_median(start, end, axis);
+                }
+            }
+
+            if (make_leaf)
+            {
+                node -> first = start;
+                node -> count = object_span;
+                return node;
+            }
+
+            node -> axis = axis;
+
+            if (pool && object_span >= parallel_subtree_threshold)
+            {
+                task_group group(*pool);
+                group.run([&]() { node -> children[0] = build_subtree(start, mid, depth + 1); });
+                node -> children[1] = build_subtree(mid, end, depth + 1);
+                group.wait();
+            }
+            else
+            {
+                node -> children[0] = build_subtree(start, mid, depth + 1);
+                node -> children[1] = build_subtree(mid, end, depth + 1);
+            }
+
+            return node;
+        }
+};
+
+#endif
@@ -4,12 +4,21 @@
 #include "hittable.h"
 #include "rtweekend.h"
 #include "material.h"
-
-#include <thread>
+#include "thread_pool.h"
+#include "framebuffer.h"
+#include "sampler.h"
+#include "ray_queue.h"
+#include "ray_packet.h"
+#include "image_writer.h"
+#include "tone_map.h"
+
+#include <algorithm>
+#include <string>
 #include <vector>
-#include <random>
-#include <mutex>
+#include <cstdint>
 #include <atomic>
+#include <mutex>
+#include <utility>
 
 
 class camera
@@ -19,6 +28,7 @@ class camera
         int image_width = 100;
         int samples_per_pixel = 10;
         int max_depth = 10;
+        int rr_min_depth = 5;   // Bounces before Russian roulette may terminate a path
 
         double vfov = 90;
         point3 look_from = point3(0, 0, 0);
@@ -28,70 +38,68 @@ class camera
         double defocus_angle = 0;   // Variation angle of rays through each pixel
         double focus_dist = 10;     // Distance from camera lookfrom point to plane of perfect focus
 
-        void render(const hittable& world)
+        int tile_size = 16;             // Edge length in pixels of the square tiles handed to workers
+        bool float_framebuffer = false; // Store the rendered image as 32-bit floats
+        std::string output_path = "RTimg.ppm";
+        image_format output_format = image_format::ppm;
+        display_options display;        // Tone mapping and encoding for 8- and 16-bit formats
+
+        uint64_t seed = 0;              // User seed; with frame, pixel and sample it fixes every random draw
+        uint64_t frame = 0;             // Frame number, so an animation gets fresh noise per frame
+
+        // Adaptive sampling: once a pixel has adaptive_min_samples samples, stop as soon as the
+        // standard error of its mean luminance falls below adaptive_threshold times the mean.
+        // samples_per_pixel stays the hard cap. A threshold of 0 disables it.
+        double adaptive_threshold = 0;
+        int adaptive_min_samples = 16;
+        int adaptive_batch = 4;         // Samples taken between convergence checks
+
+        // Wavefront integrator: instead of following one path at a time, each tile traces queues
+        // of paths in stages (camera rays, extend, shade grouped by material, compact). Images
+        // are identical to the path-at-a-time integrator.
+        bool wavefront = false;
+        size_t wavefront_size = size_t(1) << 14;    // Most paths in flight per worker
+        bool sort_rays = false;         // Sort each bounce's rays by origin and direction octant before tracing
+
+        // Edge of the square pixel blocks whose primary rays are traced together as one packet,
+        // at most 8 (64 rays). 0 traces every ray on its own. Path integrator only.
+        int packet_size = 0;
+
+        // World is any type with hit(ray, interval, hit_record&): a hittable, or a scene whose
+        // concrete type lets the whole trace loop be inlined. The pool is shared with the rest
+        // of the program, e.g. the one that just built the scene's BVH.
+        template <typename World>
+        void render(const World& world, const material_table& materials, thread_pool& pool)
         {
             initialise();
-            
-            // Allocate buffer for pixel colours
-            std::vector<std::vector<colour>> pixel_colours(image_height, std::vector<colour>(image_width));
-
-            unsigned int num_threads = std::thread::hardware_concurrency();
-            if (num_threads == 0) num_threads = 1; // Fallback if hardware_concurrency fails
 
-            std::vector<std::thread> threads;
-            std::atomic<int> scanlines_remaining(image_height);
-
-            for (unsigned int t = 0; t < num_threads; t++)
+            if (float_framebuffer)
             {
-                threads.emplace_back([this, &world, &pixel_colours, &scanlines_remaining, num_threads, t]()
-                {
-                    // Random number generator for each thread
-                    std::mt19937 rng(std::random_device{}());
-                    std::uniform_real_distribution<double> dist(0.0, 1.0);
-
-                    for (int pixel_y = t; pixel_y < image_height; pixel_y += num_threads)
-                    {
-                        for (int pixel_x = 0; pixel_x < image_width; pixel_x++)
-                        {
-                            colour pixel_colour(0, 0, 0);
-                            for (int sample = 0; sample < samples_per_pixel; sample++)
-                            {
-                                ray ray_obj = get_ray_thread_safe(pixel_y, pixel_x, rng, dist);
-                                pixel_colour += ray_colour(ray_obj, max_depth, world, rng, dist);
-                            }
-
-                            pixel_colours[pixel_y][pixel_x] = pixel_colour;
-                        }
-
-                        int remaining = --scanlines_remaining;
-                        std::clog << "\rScanlines remaining: " << remaining << ' ' << std::flush;
-                    }
-                });
+                render_tiles(world, materials, image_f32, pool);
+                write_image(image_f32, pool);
             }
-
-            // Wait for all threads to complete
-            for (auto& thread : threads)
+            else
             {
-                thread.join();
+                render_tiles(world, materials, image, pool);
+                write_image(image, pool);
             }
-            
-            image_file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
-            for (int pixel_y = 0; pixel_y < image_height; pixel_y++)
+            if (adaptive_threshold > 0)
             {
-                for (int pixel_x = 0; pixel_x < image_width; pixel_x++)
-                {
-                    write_colour(image_file, pixel_samples_scale * pixel_colours[pixel_y][pixel_x]);
-                }
+                write_sample_counts(pool);
             }
 
             std::clog << "\rDone                 \n";
-            image_file.close();
+        }
+
+        // Rays traced in the last render, camera rays and bounces alike, whatever the integrator
+        size_t rays_traced() const
+        {
+            return rays_traced_count.load(std::memory_order_relaxed);
         }
 
     private:
         int image_height;
-        double pixel_samples_scale;
         point3 camera_center;
         point3 pixel00_location;
         vec3 pixel_delta_x;
@@ -100,17 +108,37 @@ class camera
         vec3 defocus_disk_x;
         vec3 defocus_disk_y;
         
-        std::ofstream image_file;
+        // Kept across renders so the allocation is reused frame after frame
+        framebuffer image;
+        framebuffer_f32 image_f32;
+        std::vector<int> sample_counts;     // Samples actually taken per pixel, row-major
+        std::atomic<size_t> rays_traced_count{0};   // Summed tile by tile
+
+        // Display levels of the integer output formats, three per pixel, row-major. Each tile is
+        // converted by its worker as soon as it is rendered.
+        std::vector<uint16_t> display_levels;
+        display_transform display_map;
+
+        // Scratch space of the wavefront integrator, one per worker plus one for other threads
+        struct wavefront_workspace
+        {
+            ray_queue queue;
+            std::vector<colour> sample_colours;     // Radiance of each traced sample, by queue slot
+            std::vector<uint32_t> order;            // Queue indices grouped by material type
+            std::vector<int> active_pixels;         // Tile-local pixels still taking samples
+            std::vector<colour> pixel_sums;
+            std::vector<double> luminance_means;
+            std::vector<double> luminance_m2s;
+            size_t rays_traced = 0;                 // In the current tile
+        };
+        std::vector<wavefront_workspace> wavefront_workspaces;
+        std::mutex caller_workspace_mutex;      // Guards the last workspace
 
         void initialise()
         {
-            image_file.open("RTimg.ppm");
-            
             image_height = int(image_width / aspect_ratio);
             image_height = (image_height < 1) ? 1 : image_height;
 
-            pixel_samples_scale = 1.0 / samples_per_pixel;
-
             camera_center = look_from;
 
             //auto focal_length = (look_from - look_at).get_length();
@@ -144,124 +172,683 @@ class camera
             defocus_disk_y = y * defocus_radius;
         }
 
-        ray get_ray(int pixel_y, int pixel_x) const
+        template <typename World, typename T>
+        void render_tiles(const World& world, const material_table& materials, basic_framebuffer<T>& target,
+                          thread_pool& pool)
         {
-            // Construct a camera ray originating from the defocus disk and directed 
-            // at a randomly sampled point around the pixel location x, y
+            target.resize(image_width, image_height);
+            sample_counts.assign(size_t(image_width) * image_height, 0);
 
-            auto offset = sample_square();
-            auto pixel_sample = pixel00_location
-                              + ((pixel_y + offset.get_x()) * pixel_delta_y)
-                              + ((pixel_x + offset.get_y()) * pixel_delta_x);
+            bool display_tiles = !is_float_format(output_format);
+            if (display_tiles)
+            {
+                display_levels.resize(size_t(image_width) * image_height * 3);
+                display_map = display_transform(display, (output_format == image_format::ppm_16) ? 65535 : 255);
+            }
 
-            //auto ray_origin = camera_center;
-            auto ray_origin = (defocus_angle <= 0) ? camera_center : defocus_disk_sample();
-            auto ray_direction = pixel_sample - ray_origin;
-            auto ray_time = random_double();
+            // Split the image into tiles and let the pool balance them across workers. Expensive
+            // tiles (glass, deep bounces) no longer hold up the whole frame, because idle workers
+            // steal whatever is still queued.
+            int tiles_x = (image_width + tile_size - 1) / tile_size;
+            int tiles_y = (image_height + tile_size - 1) / tile_size;
+            std::atomic<int> tiles_remaining(tiles_x * tiles_y);
 
-            // return ray(ray_origin, ray_direction);
-            return ray(ray_origin, ray_direction, ray_time);
+            rays_traced_count = 0;
+            if (wavefront)
+            {
+                wavefront_workspaces.resize(pool.size() + 1);
+            }
+
+            for (int tile_y = 0; tile_y < tiles_y; tile_y++)
+            {
+                for (int tile_x = 0; tile_x < tiles_x; tile_x++)
+                {
+                    auto view = target.tile(tile_x * tile_size, tile_y * tile_size, tile_size, tile_size);
+
+                    pool.submit([this, &world, &materials, &pool, &tiles_remaining, display_tiles, view]()
+                    {
+                        size_t tile_rays;
+                        if (wavefront)
+                        {
+                            // A thread outside the pool can run this task while it helps out in a
+                            // wait; such threads take turns with the spare last workspace
+                            int worker = pool.current_worker_index();
+                            std::unique_lock<std::mutex> caller_lock;
+                            if (worker < 0)
+                            {
+                                caller_lock = std::unique_lock<std::mutex>(caller_workspace_mutex);
+                                worker = int(pool.size());
+                            }
+                            tile_rays = render_tile_wavefront(world, materials, view, wavefront_workspaces[worker]);
+                        }
+                        else if (packet_size > 0)
+                        {
+                            tile_rays = render_tile_packets(world, materials, view);
+                        }
+                        else
+                        {
+                            tile_rays = render_tile(world, materials, view);
+                        }
+                        rays_traced_count.fetch_add(tile_rays, std::memory_order_relaxed);
+
+                        if (display_tiles)
+                        {
+                            display_tile(view);
+                        }
+
+                        int remaining = --tiles_remaining;
+                        std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+                    });
+                }
+            }
+
+            // Wait for all tiles to complete
+            pool.wait_idle();
         }
 
-        // Thread-safe version of get_ray
-        ray get_ray_thread_safe(int pixel_y, int pixel_x, std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
+        template <typename View>
+        void display_tile(const View& view)
         {
-            auto offset = sample_square_thread_safe(rng, dist);
-            auto pixel_sample = pixel00_location
-                              + ((pixel_y + offset.get_x()) * pixel_delta_y)
-                              + ((pixel_x + offset.get_y()) * pixel_delta_x);
+            for (int local_y = 0; local_y < view.height; local_y++)
+            {
+                int pixel_y = view.y0 + local_y;
+                uint16_t* levels = &display_levels[(size_t(pixel_y) * image_width + view.x0) * 3];
+                display_map.apply_row(view.row(local_y), view.width, view.x0, pixel_y, levels);
+            }
+        }
 
-            auto ray_origin = (defocus_angle <= 0) ? camera_center : defocus_disk_sample_thread_safe(rng, dist);
-            auto ray_direction = pixel_sample - ray_origin;
-            auto ray_time = dist(rng);
+        // Each render_tile variant returns the number of rays it traced
+        template <typename World, typename View>
+        size_t render_tile(const World& world, const material_table& materials, const View& view)
+        {
+            size_t rays = 0;
+            for (int local_y = 0; local_y < view.height; local_y++)
+            {
+                for (int local_x = 0; local_x < view.width; local_x++)
+                {
+                    int pixel_y = view.y0 + local_y;
+                    int pixel_x = view.x0 + local_x;
+                    size_t pixel_index = size_t(pixel_y) * image_width + pixel_x;
 
-            return ray(ray_origin, ray_direction, ray_time);
+                    view.set(local_x, local_y, render_pixel(world, materials, pixel_y, pixel_x, sample_counts[pixel_index], rays));
+                }
+            }
+            return rays;
         }
 
-        vec3 sample_square() const
+        template <typename World>
+        colour render_pixel(const World& world, const material_table& materials, int pixel_y, int pixel_x, int& sample_count,
+                            size_t& rays) const
         {
-            // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square
-            return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+            uint64_t pixel_index = uint64_t(pixel_y) * image_width + pixel_x;
+            bool adaptive = adaptive_threshold > 0;
+
+            colour pixel_colour(0, 0, 0);
+            double luminance_mean = 0;
+            double luminance_m2 = 0;    // Sum of squared deviations from the mean (Welford)
+
+            sample_count = 0;
+            while (sample_count < samples_per_pixel)
+            {
+                auto rng = sampler::for_sample(seed, frame, pixel_index, sample_count);
+                ray ray_obj = get_ray(pixel_y, pixel_x, rng);
+                colour sample_colour = ray_colour(ray_obj, world, materials, rng, rays);
+
+                pixel_colour += sample_colour;
+                sample_count++;
+
+                if (adaptive)
+                {
+                    double sample_luminance = luminance(sample_colour);
+                    double delta = sample_luminance - luminance_mean;
+                    luminance_mean += delta / sample_count;
+                    luminance_m2 += delta * (sample_luminance - luminance_mean);
+
+                    if (sample_count >= adaptive_min_samples
+                        && sample_count % adaptive_batch == 0
+                        && pixel_converged(luminance_mean, luminance_m2, sample_count))
+                    {
+                        break;
+                    }
+                }
+            }
+
+            return pixel_colour / sample_count;
         }
 
-        vec3 sample_square_thread_safe(std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
+        // Packet counterpart of the per-pixel loop in render_tiles. The tile is walked in blocks of
+        // packet_size x packet_size pixels, each traced by render_packet_block.
+        template <typename World, typename View>
+        size_t render_tile_packets(const World& world, const material_table& materials, const View& view)
         {
-            return vec3(dist(rng) - 0.5, dist(rng) - 0.5, 0);
+            size_t rays = 0;
+            int block_size = std::min(packet_size, 8);
+            colour block_colours[ray_packet::capacity];
+
+            for (int block_y = 0; block_y < view.height; block_y += block_size)
+            {
+                for (int block_x = 0; block_x < view.width; block_x += block_size)
+                {
+                    int block_width = std::min(block_size, view.width - block_x);
+                    int block_height = std::min(block_size, view.height - block_y);
+                    rays += render_packet_block(world, materials, view.x0 + block_x, view.y0 + block_y,
+                                                block_width, block_height, block_colours);
+
+                    for (int pixel = 0; pixel < block_width * block_height; pixel++)
+                    {
+                        view.set(block_x + pixel % block_width, block_y + pixel / block_width, block_colours[pixel]);
+                    }
+                }
+            }
+            return rays;
         }
 
-        point3 defocus_disk_sample() const
+        // Sample by sample, the primary rays of the block's pixels that are still sampling are
+        // traced as one packet; each path then carries on by itself from its first hit. Every
+        // sample keeps its own random stream and the adaptive checks fall where render_pixel
+        // makes them, so the image is the same. Writes the block's pixels in row order to
+        // pixel_colours and returns the number of rays traced.
+        template <typename World>
+        size_t render_packet_block(const World& world, const material_table& materials, int x0, int y0,
+                                 int block_width, int block_height, colour* pixel_colours)
         {
-            // Returns a random point in the camera defocus disk.
-            auto point = random_in_unit_disk();
-            return camera_center + (point[0] * defocus_disk_x) + (point[1] * defocus_disk_y);
+            constexpr int max_block_pixels = ray_packet::capacity;
+            bool adaptive = adaptive_threshold > 0;
+            int pixel_count = block_width * block_height;
+            size_t rays = 0;
+
+            ray_packet packet;
+            sampler path_rngs[max_block_pixels];
+            int packet_pixels[max_block_pixels];
+
+            double luminance_means[max_block_pixels];
+            double luminance_m2s[max_block_pixels];
+            bool sampling[max_block_pixels];
+
+            for (int pixel = 0; pixel < pixel_count; pixel++)
+            {
+                pixel_colours[pixel] = colour(0, 0, 0);
+                luminance_means[pixel] = 0;
+                luminance_m2s[pixel] = 0;
+                sampling[pixel] = true;
+            }
+
+            auto pixel_index = [&](int pixel)
+            {
+                return uint64_t(y0 + pixel / block_width) * image_width + (x0 + pixel % block_width);
+            };
+
+            int sampling_count = pixel_count;
+            for (int sample = 0; sample < samples_per_pixel && sampling_count > 0; sample++)
+            {
+                packet.clear();
+                for (int pixel = 0; pixel < pixel_count; pixel++)
+                {
+                    if (sampling[pixel])
+                    {
+                        auto rng = sampler::for_sample(seed, frame, pixel_index(pixel), sample);
+                        packet.add(get_ray(y0 + pixel / block_width, x0 + pixel % block_width, rng));
+                        path_rngs[packet.count - 1] = rng;
+                        packet_pixels[packet.count - 1] = pixel;
+                    }
+                }
+
+                packet.prepare();
+                hit_packet(world, packet);
+                rays += size_t(packet.count);
+
+                for (int i = 0; i < packet.count; i++)
+                {
+                    int pixel = packet_pixels[i];
+                    colour sample_colour = packet_ray_colour(packet, i, world, materials, path_rngs[i], rays);
+                    pixel_colours[pixel] += sample_colour;
+
+                    if (!adaptive)
+                    {
+                        continue;
+                    }
+
+                    int sample_count = sample + 1;
+                    double sample_luminance = luminance(sample_colour);
+                    double delta = sample_luminance - luminance_means[pixel];
+                    luminance_means[pixel] += delta / sample_count;
+                    luminance_m2s[pixel] += delta * (sample_luminance - luminance_means[pixel]);
+
+                    if (sample_count >= adaptive_min_samples
+                        && sample_count % adaptive_batch == 0
+                        && pixel_converged(luminance_means[pixel], luminance_m2s[pixel], sample_count))
+                    {
+                        sampling[pixel] = false;
+                        sampling_count--;
+                        pixel_colours[pixel] = pixel_colours[pixel] / sample_count;
+                        sample_counts[pixel_index(pixel)] = sample_count;
+                    }
+                }
+            }
+
+            for (int pixel = 0; pixel < pixel_count; pixel++)
+            {
+                if (sampling[pixel])
+                {
+                    pixel_colours[pixel] = pixel_colours[pixel] / samples_per_pixel;
+                    sample_counts[pixel_index(pixel)] = samples_per_pixel;
+                }
+            }
+            return rays;
         }
 
-        point3 defocus_disk_sample_thread_safe(std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
+        // Wavefront counterpart of the per-pixel loop in render_tiles. Samples are taken in rounds:
+        // without adaptive sampling a single round takes them all; with it, each round runs up to
+        // render_pixel's next convergence check, and only pixels that have not converged take
+        // part in the next one. Every sample keeps its own random stream and is summed in sample
+        // order, so the image matches render_pixel's bit for bit.
+        template <typename World, typename View>
+        size_t render_tile_wavefront(const World& world, const material_table& materials, const View& view,
+                                     wavefront_workspace& workspace)
         {
-            auto point = random_in_unit_disk_thread_safe(rng, dist);
-            return camera_center + (point[0] * defocus_disk_x) + (point[1] * defocus_disk_y);
+            workspace.rays_traced = 0;
+            int pixel_count = view.width * view.height;
+            bool adaptive = adaptive_threshold > 0;
+
+            auto& active = workspace.active_pixels;
+            active.resize(pixel_count);
+            for (int pixel = 0; pixel < pixel_count; pixel++)
+            {
+                active[pixel] = pixel;
+            }
+            workspace.pixel_sums.assign(pixel_count, colour(0, 0, 0));
+            workspace.luminance_means.assign(pixel_count, 0);
+            workspace.luminance_m2s.assign(pixel_count, 0);
+
+            auto finish_pixel = [&](int pixel, int sample_count)
+            {
+                int local_x = pixel % view.width;
+                int local_y = pixel / view.width;
+                size_t pixel_index = size_t(view.y0 + local_y) * image_width + (view.x0 + local_x);
+
+                view.set(local_x, local_y, workspace.pixel_sums[pixel] / sample_count);
+                sample_counts[pixel_index] = sample_count;
+            };
+
+            // render_pixel checks at the first multiple of adaptive_batch from adaptive_min_samples on
+            int next_check = samples_per_pixel;
+            if (adaptive)
+            {
+                next_check = (std::max(adaptive_min_samples, 1) + adaptive_batch - 1) / adaptive_batch * adaptive_batch;
+            }
+
+            int samples_taken = 0;
+            while (true)
+            {
+                int round_end = std::min(next_check, samples_per_pixel);
+                int round_samples = round_end - samples_taken;
+                trace_samples(world, materials, view, samples_taken, round_samples, workspace);
+
+                for (size_t k = 0; k < active.size(); k++)
+                {
+                    int pixel = active[k];
+                    for (int sample = 0; sample < round_samples; sample++)
+                    {
+                        colour sample_colour = workspace.sample_colours[k * round_samples + sample];
+                        workspace.pixel_sums[pixel] += sample_colour;
+
+                        if (adaptive)
+                        {
+                            double sample_luminance = luminance(sample_colour);
+                            double delta = sample_luminance - workspace.luminance_means[pixel];
+                            workspace.luminance_means[pixel] += delta / (samples_taken + sample + 1);
+                            workspace.luminance_m2s[pixel] += delta * (sample_luminance - workspace.luminance_means[pixel]);
+                        }
+                    }
+                }
+                samples_taken = round_end;
+
+                if (samples_taken >= samples_per_pixel)
+                {
+                    break;
+                }
+
+                // Converged pixels are done; the rest go on to the next round
+                size_t kept = 0;
+                for (int pixel : active)
+                {
+                    if (pixel_converged(workspace.luminance_means[pixel], workspace.luminance_m2s[pixel], samples_taken))
+                    {
+                        finish_pixel(pixel, samples_taken);
+                    }
+                    else
+                    {
+                        active[kept++] = pixel;
+                    }
+                }
+                active.resize(kept);
+
+                if (active.empty())
+                {
+                    return workspace.rays_traced;
+                }
+                next_check += adaptive_batch;
+            }
+
+            for (int pixel : active)
+            {
+                finish_pixel(pixel, samples_taken);
+            }
+            return workspace.rays_traced;
         }
 
-        vec3 random_in_unit_disk_thread_safe(std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
+        // Trace samples [first_sample, first_sample + sample_count) of every active pixel, leaving
+        // sample s of active pixel k in sample_colours[k * sample_count + s]. The paths go through
+        // the stages in waves of at most wavefront_size, which bounds the queue's memory.
+        template <typename World, typename View>
+        void trace_samples(const World& world, const material_table& materials, const View& view,
+                           int first_sample, int sample_count, wavefront_workspace& workspace) const
         {
-            while (true)
+            size_t path_count = workspace.active_pixels.size() * size_t(sample_count);
+            workspace.sample_colours.assign(path_count, colour(0, 0, 0));
+
+            size_t wave_size = std::max(wavefront_size, size_t(1));
+            for (size_t wave_start = 0; wave_start < path_count; wave_start += wave_size)
+            {
+                size_t wave_end = std::min(path_count, wave_start + wave_size);
+                workspace.queue.reset(wave_end - wave_start);
+
+                generate_camera_rays(view, first_sample, sample_count, wave_start, wave_end, workspace);
+
+                // Every path in a wave is at the same depth, so the bounce count is shared. Paths
+                // still going after max_depth bounces gather no light and their slots stay black.
+                for (int depth = 0; depth < max_depth && !workspace.queue.empty(); depth++)
+                {
+                    // Camera rays are already coherent in pixel order; scattered rays are not
+                    if (sort_rays && depth > 0)
+                    {
+                        workspace.queue.sort_coherent();
+                    }
+
+                    workspace.rays_traced += workspace.queue.size();
+                    extend(world, workspace.queue);
+                    shade(materials, depth, workspace);
+                    workspace.queue.compact();
+                }
+            }
+        }
+
+        // Stage 1: a camera ray per path, drawn from the same random stream render_pixel would use
+        template <typename View>
+        void generate_camera_rays(const View& view, int first_sample, int sample_count, size_t wave_start,
+                                  size_t wave_end, wavefront_workspace& workspace) const
+        {
+            for (size_t path = wave_start; path < wave_end; path++)
             {
-                auto point = vec3(dist(rng) * 2.0 - 1.0, dist(rng) * 2.0 - 1.0, 0);
-                if (point.get_length_squared() < 1)
-                    return point;
+                int pixel = workspace.active_pixels[path / sample_count];
+                int pixel_x = view.x0 + pixel % view.width;
+                int pixel_y = view.y0 + pixel / view.width;
+                uint64_t pixel_index = uint64_t(pixel_y) * image_width + pixel_x;
+
+                auto rng = sampler::for_sample(seed, frame, pixel_index, first_sample + path % sample_count);
+                ray ray_obj = get_ray(pixel_y, pixel_x, rng);
+                workspace.queue.push(ray_obj, rng, uint32_t(path));
             }
         }
-        
-        colour ray_colour(const ray& ray_obj, int depth, const hittable& world) const
+
+        // Stage 2: closest hit of every path in the queue
+        template <typename World>
+        void extend(const World& world, ray_queue& queue) const
         {
-            // If we've exceeded the ray bounce limit, no more light is gathered
-            if (depth <= 0)
+            for (size_t index = 0; index < queue.size(); index++)
             {
-                return colour(0, 0, 0);
+                queue.hits[index] = hit_record();
+                queue.has_hit[index] = world.hit(queue.get_ray(index), interval(0, infinity), queue.hits[index]);
             }
-            
-            hit_record record;
-            
-            if (world.hit(ray_obj, interval(0.001, infinity), record))
+        }
+
+        // Stage 3: shade every path, grouped by material type so each group runs a single
+        // material's scatter code back to back. Paths that missed form one more group and pick
+        // up the background. Paths that end are marked dead for the compact stage.
+        void shade(const material_table& materials, int depth, wavefront_workspace& workspace) const
+        {
+            ray_queue& queue = workspace.queue;
+            const int miss_group = material_table::type_count;
+
+            auto group_of = [&](size_t index)
+            {
+                return queue.has_hit[index] ? materials.type(queue.hits[index].mat) : miss_group;
+            };
+
+            // Counting sort of the queue indices by group
+            size_t group_start[material_table::type_count + 2] = {};
+            for (size_t index = 0; index < queue.size(); index++)
+            {
+                group_start[group_of(index) + 1]++;
+            }
+            for (int group = 0; group <= miss_group; group++)
+            {
+                group_start[group + 1] += group_start[group];
+            }
+
+            size_t group_next[material_table::type_count + 1];
+            std::copy(group_start, group_start + miss_group + 1, group_next);
+            workspace.order.resize(queue.size());
+            for (size_t index = 0; index < queue.size(); index++)
+            {
+                workspace.order[group_next[group_of(index)]++] = uint32_t(index);
+            }
+
+            for (size_t k = group_start[miss_group]; k < group_start[miss_group + 1]; k++)
+            {
+                uint32_t index = workspace.order[k];
+                workspace.sample_colours[queue.slot[index]] = queue.get_throughput(index) * background(queue.get_ray(index));
+                queue.alive[index] = 0;
+            }
+
+            shade_groups(materials, depth, workspace, group_start, std::make_index_sequence<material_table::type_count>());
+        }
+
+        template <size_t... I>
+        void shade_groups(const material_table& materials, int depth, wavefront_workspace& workspace,
+                          const size_t* group_start, std::index_sequence<I...>) const
+        {
+            (shade_group<std::variant_alternative_t<I, material>>(materials, depth, workspace, group_start[I], group_start[I + 1]), ...);
+        }
+
+        template <typename Material>
+        void shade_group(const material_table& materials, int depth, wavefront_workspace& workspace,
+                         size_t begin, size_t end) const
+        {
+            ray_queue& queue = workspace.queue;
+            for (size_t k = begin; k < end; k++)
             {
+                uint32_t index = workspace.order[k];
+                const hit_record& record = queue.hits[index];
+
                 ray scattered;
                 colour attenuation;
-                if (record.mat -> scatter(ray_obj, record, attenuation, scattered))
+                bool alive = materials.get<Material>(record.mat).scatter(queue.get_ray(index), record, attenuation,
+                                                                          scattered, queue.rng[index]);
+                if (alive)
                 {
-                    return attenuation * ray_colour(scattered, depth - 1, world);
+                    colour throughput = queue.get_throughput(index) * attenuation;
+                    alive = russian_roulette(throughput, depth, queue.rng[index]);
+                    queue.set_ray(index, scattered);
+                    queue.set_throughput(index, throughput);
                 }
+                queue.alive[index] = alive;
+            }
+        }
 
-                return colour(0, 0, 0);
+        static double luminance(const colour& pixel_colour)
+        {
+            return 0.2126 * pixel_colour.get_x() + 0.7152 * pixel_colour.get_y() + 0.0722 * pixel_colour.get_z();
+        }
+
+        bool pixel_converged(double mean, double m2, int count) const
+        {
+            // Standard error of the mean against a relative tolerance. The floor on the mean keeps
+            // near-black pixels from chasing a vanishing target.
+            double variance = m2 / (count - 1);
+            double standard_error = std::sqrt(variance / count);
+            return standard_error <= adaptive_threshold * std::fmax(mean, 0.05);
+        }
+
+        void write_sample_counts(thread_pool& pool) const
+        {
+            // Greyscale image of where the samples went: white is the samples_per_pixel cap. It
+            // holds display levels, so float output formats get a PNG map instead.
+            auto level = [&](int x, int y, int, int max_value)
+            {
+                return int(double(max_value) * sample_counts[size_t(y) * image_width + x] / samples_per_pixel);
+            };
+
+            image_format map_format = is_float_format(output_format) ? image_format::png : output_format;
+            std::string map_path = replace_extension(output_path, std::string("_samples") + image_format_extension(map_format));
+            if (map_format == image_format::png)
+            {
+                write_file(map_path, encode_png(image_width, image_height, level, &pool));
             }
-            
-            vec3 unit_direction = unit_vector(ray_obj.get_direction());
-            auto a = 0.5 * (unit_direction.get_y() + 1.0);
-            return (1.0 - a) * colour(1.0, 1.0, 1.0)
-                + a * colour(0.5, 0.7, 1.0);
+            else
+            {
+                write_file(map_path, encode_ppm(image_width, image_height, map_format, level));
+            }
+
+            size_t total_samples = 0;
+            for (int count : sample_counts)
+            {
+                total_samples += count;
+            }
+
+            std::clog << "\rAverage samples per pixel: "
+                      << double(total_samples) / sample_counts.size() << '\n';
         }
 
-        // Thread-safe version of ray_colour
-        colour ray_colour(const ray& ray_obj, int depth, const hittable& world, std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
+        template <typename T>
+        void write_image(const basic_framebuffer<T>& source, thread_pool& pool) const
         {
-            if (depth <= 0)
+            if (is_float_format(output_format))
             {
-                return colour(0, 0, 0);
+                write_file(output_path, encode_float_image(source, output_format));
             }
-            
-            hit_record record;
-            
-            if (world.hit(ray_obj, interval(0.001, infinity), record))
+            else
+            {
+                write_file(output_path, encode_levels(source.width(), source.height(), display_levels.data(),
+                                                      output_format, &pool));
+            }
+        }
+
+        ray get_ray(int pixel_y, int pixel_x, sampler& rng) const
+        {
+            // Construct a camera ray originating from the defocus disk and directed 
+            // at a randomly sampled point around the pixel location x, y
+
+            auto offset = rng.random_in_unit_square();
+            auto pixel_sample = pixel00_location
+                              + ((pixel_y + offset.get_x()) * pixel_delta_y)
+                              + ((pixel_x + offset.get_y()) * pixel_delta_x);
+
+            auto ray_origin = (defocus_angle <= 0) ? camera_center : defocus_disk_sample(rng);
+            auto ray_direction = pixel_sample - ray_origin;
+            auto ray_time = rng.random_double();
+
+            return ray(ray_origin, ray_direction, ray_time);
+        }
+
+        point3 defocus_disk_sample(sampler& rng) const
+        {
+            // Returns a random point in the camera defocus disk.
+            auto point = rng.random_in_unit_disk();
+            return camera_center + (point[0] * defocus_disk_x) + (point[1] * defocus_disk_y);
+        }
+        
+        // Follow the path bounce by bounce, carrying the product of the attenuations so far.
+        // max_depth is only a safety cap: past rr_min_depth bounces, Russian roulette ends
+        // low-throughput paths early and reweights the survivors so the estimate stays
+        // unbiased. A path whose first bounces were taken elsewhere (render_tile_packets)
+        // continues from its throughput at first_depth. That is a template parameter so the
+        // per-pixel loop keeps an instantiation of its own, inlined like before packets existed.
+        template <int first_depth = 0, typename World>
+        colour ray_colour(const ray& primary_ray, const World& world, const material_table& materials,
+                          sampler& rng, size_t& rays, colour throughput = colour(1.0, 1.0, 1.0)) const
+        {
+            ray ray_obj = primary_ray;
+
+            for (int depth = first_depth; depth < max_depth; depth++)
             {
+                hit_record record;
+                rays++;
+
+                if (!world.hit(ray_obj, interval(0, infinity), record))
+                {
+                    return throughput * background(ray_obj);
+                }
+
                 ray scattered;
                 colour attenuation;
-                if (record.mat -> scatter_thread_safe(ray_obj, record, attenuation, scattered, rng, dist))
+                if (!materials.scatter(record.mat, ray_obj, record, attenuation, scattered, rng))
+                {
+                    return colour(0, 0, 0);
+                }
+
+                throughput = throughput * attenuation;
+                ray_obj = scattered;
+
+                if (!russian_roulette(throughput, depth, rng))
                 {
-                    return attenuation * ray_colour(scattered, depth - 1, world, rng, dist);
+                    return colour(0, 0, 0);
                 }
+            }
+
+            // If we've exceeded the ray bounce limit, no more light is gathered
+            return colour(0, 0, 0);
+        }
+
+        // The first bounce of ray_colour for a primary ray already traced in a packet, then the
+        // rest of the path as usual
+        template <typename World>
+        colour packet_ray_colour(const ray_packet& packet, int i, const World& world, const material_table& materials,
+                                 sampler& rng, size_t& rays) const
+        {
+            colour throughput(1.0, 1.0, 1.0);
+            if (!((packet.hit_mask >> i) & 1))
+            {
+                return throughput * background(packet.rays[i]);
+            }
 
+            ray scattered;
+            colour attenuation;
+            const hit_record& record = packet.records[i];
+            if (!materials.scatter(record.mat, packet.rays[i], record, attenuation, scattered, rng))
+            {
                 return colour(0, 0, 0);
             }
-            
+
+            throughput = throughput * attenuation;
+            if (!russian_roulette(throughput, 0, rng))
+            {
+                return colour(0, 0, 0);
+            }
+
+            return ray_colour<1>(scattered, world, materials, rng, rays, throughput);
+        }
+
+        // Past rr_min_depth bounces, end the path with probability falling with its throughput,
+        // and reweight it if it survives. Returns false if the path ends.
+        bool russian_roulette(colour& throughput, int depth, sampler& rng) const
+        {
+            if (depth + 1 < rr_min_depth)
+            {
+                return true;
+            }
+
+            double survive = std::fmin(std::fmax(throughput.get_x(), std::fmax(throughput.get_y(), throughput.get_z())), 0.95);
+            if (rng.random_double() >= survive)
+            {
+                return false;
+            }
+            throughput /= survive;
+            return true;
+        }
+
+        colour background(const ray& ray_obj) const
+        {
             vec3 unit_direction = unit_vector(ray_obj.get_direction());
             auto a = 0.5 * (unit_direction.get_y() + 1.0);
             return (1.0 - a) * colour(1.0, 1.0, 1.0)
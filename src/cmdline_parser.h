@@ -2,6 +2,9 @@
 #define CMDLINE_PARSER_H
 
 #include "rtweekend.h"
+#include "image_writer.h"
+#include "tone_map.h"
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -11,12 +14,31 @@ struct camera_config
     int image_width = 512;
     int samples_per_pixel = 100;
     int max_depth = 100;
+    int rr_min_depth = 5;
     double vfov = 20.0;
     point3 look_from = point3(13, 2, 3);
     point3 look_at = point3(0, 0, 0);
     vec3 view_up = vec3(0, 1, 0);
     double defocus_angle = 0.6;
     double focus_dist = 10.0;
+    int tile_size = 16;
+    unsigned int threads = 0;
+    bool float_framebuffer = false;
+    std::string output_path = "RTimg.ppm";
+    image_format output_format = image_format::ppm;
+    display_options display;
+    uint64_t seed = 0;
+    uint64_t frame = 0;
+    double adaptive_threshold = 0;
+    int adaptive_min_samples = 16;
+    bool bvh_sah = true;
+    int bvh_bins = 16;
+    int bvh_leaf_size = 4;
+    int bvh_width = 8;
+    bool single_precision = false;
+    bool wavefront = false;
+    bool sort_rays = false;
+    int packet_size = 0;
 };
 
 void print_help(const char* program_name)
@@ -28,13 +50,43 @@ void print_help(const char* program_name)
     std::cout << "  --aspect RATIO          Aspect ratio as decimal (default: 1.777778 for 16:9)\n";
     std::cout << "                          OR use --aspect W H for width:height ratio\n";
     std::cout << "  --samples SAMPLES       Samples per pixel (default: 100)\n";
+    std::cout << "  --adaptive THRESHOLD    Stop sampling a pixel once its relative noise is below\n";
+    std::cout << "                          THRESHOLD, e.g. 0.02; --samples becomes the cap (default: off)\n";
+    std::cout << "  --min-samples SAMPLES   Samples taken before adaptive sampling may stop (default: 16)\n";
     std::cout << "  --depth DEPTH           Maximum ray bounce depth (default: 100)\n";
+    std::cout << "  --rr-depth DEPTH        Bounces before Russian roulette may end a path (default: 5)\n";
+    std::cout << "  --integrator I          path (one path at a time) or wavefront (queues of rays in\n";
+    std::cout << "                          stages); both give the same image (default: path)\n";
+    std::cout << "  --sort-rays             Wavefront only: sort each bounce's rays by origin and\n";
+    std::cout << "                          direction before tracing them, for coherent traversals\n";
     std::cout << "  --vfov ANGLE            Vertical field of view in degrees (default: 20)\n";
     std::cout << "  --lookfrom X Y Z        Camera position (default: 13 2 3)\n";
     std::cout << "  --lookat X Y Z          Point camera looks at (default: 0 0 0)\n";
     std::cout << "  --vup X Y Z             Camera up vector (default: 0 1 0)\n";
     std::cout << "  --defocus ANGLE         Defocus angle for depth of field (default: 0.6)\n";
-    std::cout << "  --focusdist DIST        Focus distance (default: 10.0)\n\n";
+    std::cout << "  --focusdist DIST        Focus distance (default: 10.0)\n";
+    std::cout << "  --bvh median|sah        BVH split method (default: sah)\n";
+    std::cout << "  --bvh-bins BINS         Bins per axis for the SAH builder (default: 16)\n";
+    std::cout << "  --bvh-width 2|4|8       Children per BVH node (default: 8)\n";
+    std::cout << "  --bvh-leaf SIZE         Maximum primitives per BVH leaf (default: 4)\n";
+    std::cout << "  --packets SIZE          Trace primary rays in packets of SIZE x SIZE pixels, 4 or 8;\n";
+    std::cout << "                          0 traces single rays; path integrator only (default: 0)\n";
+    std::cout << "  --precision P           Precision of geometry and intersection tests, float or double\n";
+    std::cout << "                          (default: double)\n";
+    std::cout << "  --tile SIZE             Edge length of render tiles in pixels (default: 16)\n";
+    std::cout << "  --threads COUNT         Worker threads, 0 for all hardware threads (default: 0)\n";
+    std::cout << "  --fb32                  Store the framebuffer as 32-bit floats\n";
+    std::cout << "  --output PATH           Image file to write (default: RTimg.ppm)\n";
+    std::cout << "  --format F              Output format: ppm (binary), ppm16 (binary, 16 bits per\n";
+    std::cout << "                          channel), ppm-ascii, png, or linear float hdr or exr\n";
+    std::cout << "                          (default: from the --output extension, else ppm)\n";
+    std::cout << "  --tonemap T             Tone mapper for ppm and png output: clamp, reinhard or aces\n";
+    std::cout << "                          (default: clamp)\n";
+    std::cout << "  --transfer F            Display encoding: gamma2 or srgb (default: gamma2)\n";
+    std::cout << "  --exposure SCALE        Multiply the radiance by SCALE before tone mapping (default: 1)\n";
+    std::cout << "  --dither                Apply an 8x8 ordered dither before quantising\n";
+    std::cout << "  --seed SEED             Random seed; equal seeds give identical images (default: 0)\n";
+    std::cout << "  --frame FRAME           Frame number mixed into the seed (default: 0)\n\n";
     std::cout << "Example:\n";
     std::cout << "  " << program_name << " --width 1024 --samples 200 --lookfrom 10 3 5\n";
     std::cout << "  " << program_name << " --aspect 16 9 --width 1920\n";
@@ -63,6 +115,8 @@ bool parse_vec3(int argc, char* argv[], int& i, vec3& v, const char* arg_name)
 
 bool parse_arguments(int argc, char* argv[], camera_config& config)
 {
+    bool format_given = false;
+
     for (int i = 1; i < argc; i++)
     {
         std::string arg = argv[i];
@@ -174,6 +228,56 @@ bool parse_arguments(int argc, char* argv[], camera_config& config)
                 return false;
             }
         }
+        else if (arg == "--adaptive")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.adaptive_threshold = std::stod(argv[++i]);
+                    if (config.adaptive_threshold < 0)
+                    {
+                        std::cerr << "Error: Adaptive threshold must be non-negative\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --adaptive\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --adaptive requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--min-samples")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.adaptive_min_samples = std::stoi(argv[++i]);
+                    if (config.adaptive_min_samples < 2)
+                    {
+                        std::cerr << "Error: Minimum samples must be at least 2\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --min-samples\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --min-samples requires a value\n";
+                return false;
+            }
+        }
         else if (arg == "--depth")
         {
             if (i + 1 < argc)
@@ -199,6 +303,31 @@ bool parse_arguments(int argc, char* argv[], camera_config& config)
                 return false;
             }
         }
+        else if (arg == "--rr-depth")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.rr_min_depth = std::stoi(argv[++i]);
+                    if (config.rr_min_depth <= 0)
+                    {
+                        std::cerr << "Error: Russian roulette depth must be positive\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --rr-depth\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --rr-depth requires a value\n";
+                return false;
+            }
+        }
         else if (arg == "--vfov")
         {
             if (i + 1 < argc)
@@ -295,6 +424,392 @@ bool parse_arguments(int argc, char* argv[], camera_config& config)
                 return false;
             }
         }
+        else if (arg == "--integrator")
+        {
+            if (i + 1 < argc)
+            {
+                std::string integrator = argv[++i];
+                if (integrator == "path")
+                {
+                    config.wavefront = false;
+                }
+                else if (integrator == "wavefront")
+                {
+                    config.wavefront = true;
+                }
+                else
+                {
+                    std::cerr << "Error: --integrator must be 'path' or 'wavefront'\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --integrator requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--sort-rays")
+        {
+            config.sort_rays = true;
+        }
+        else if (arg == "--packets")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.packet_size = std::stoi(argv[++i]);
+                    if (config.packet_size != 0 && config.packet_size != 4 && config.packet_size != 8)
+                    {
+                        std::cerr << "Error: Packet size must be 0, 4 or 8\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --packets\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --packets requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--precision")
+        {
+            if (i + 1 < argc)
+            {
+                std::string precision = argv[++i];
+                if (precision == "double")
+                {
+                    config.single_precision = false;
+                }
+                else if (precision == "float")
+                {
+                    config.single_precision = true;
+                }
+                else
+                {
+                    std::cerr << "Error: --precision must be 'float' or 'double'\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --precision requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--bvh")
+        {
+            if (i + 1 < argc)
+            {
+                std::string method = argv[++i];
+                if (method == "sah")
+                {
+                    config.bvh_sah = true;
+                }
+                else if (method == "median")
+                {
+                    config.bvh_sah = false;
+                }
+                else
+                {
+                    std::cerr << "Error: --bvh must be 'median' or 'sah'\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --bvh requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--bvh-bins")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.bvh_bins = std::stoi(argv[++i]);
+                    if (config.bvh_bins < 2)
+                    {
+                        std::cerr << "Error: BVH bin count must be at least 2\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --bvh-bins\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --bvh-bins requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--bvh-width")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.bvh_width = std::stoi(argv[++i]);
+                    if (config.bvh_width != 2 && config.bvh_width != 4 && config.bvh_width != 8)
+                    {
+                        std::cerr << "Error: BVH width must be 2, 4 or 8\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --bvh-width\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --bvh-width requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--bvh-leaf")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.bvh_leaf_size = std::stoi(argv[++i]);
+                    if (config.bvh_leaf_size <= 0)
+                    {
+                        std::cerr << "Error: BVH leaf size must be positive\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --bvh-leaf\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --bvh-leaf requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--tile")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.tile_size = std::stoi(argv[++i]);
+                    if (config.tile_size <= 0)
+                    {
+                        std::cerr << "Error: Tile size must be positive\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --tile\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --tile requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--threads")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    int threads = std::stoi(argv[++i]);
+                    if (threads < 0)
+                    {
+                        std::cerr << "Error: Thread count must be non-negative\n";
+                        return false;
+                    }
+                    config.threads = unsigned(threads);
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --threads\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --threads requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--fb32")
+        {
+            config.float_framebuffer = true;
+        }
+        else if (arg == "--output")
+        {
+            if (i + 1 < argc)
+            {
+                config.output_path = argv[++i];
+            }
+            else
+            {
+                std::cerr << "Error: --output requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--format")
+        {
+            if (i + 1 < argc)
+            {
+                if (!image_format_from_name(argv[++i], config.output_format))
+                {
+                    std::cerr << "Error: --format must be 'ppm', 'ppm16', 'ppm-ascii', 'png', 'hdr' or 'exr'\n";
+                    return false;
+                }
+                format_given = true;
+            }
+            else
+            {
+                std::cerr << "Error: --format requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--tonemap")
+        {
+            if (i + 1 < argc)
+            {
+                std::string mapper = argv[++i];
+                if (mapper == "clamp")
+                {
+                    config.display.mapper = tone_mapper::clamp;
+                }
+                else if (mapper == "reinhard")
+                {
+                    config.display.mapper = tone_mapper::reinhard;
+                }
+                else if (mapper == "aces")
+                {
+                    config.display.mapper = tone_mapper::aces;
+                }
+                else
+                {
+                    std::cerr << "Error: --tonemap must be 'clamp', 'reinhard' or 'aces'\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --tonemap requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--transfer")
+        {
+            if (i + 1 < argc)
+            {
+                std::string transfer = argv[++i];
+                if (transfer == "gamma2")
+                {
+                    config.display.transfer = transfer_function::gamma_2;
+                }
+                else if (transfer == "srgb")
+                {
+                    config.display.transfer = transfer_function::srgb;
+                }
+                else
+                {
+                    std::cerr << "Error: --transfer must be 'gamma2' or 'srgb'\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --transfer requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--exposure")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.display.exposure = std::stod(argv[++i]);
+                    if (config.display.exposure <= 0)
+                    {
+                        std::cerr << "Error: Exposure must be positive\n";
+                        return false;
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --exposure\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --exposure requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--dither")
+        {
+            config.display.dither = true;
+        }
+        else if (arg == "--seed")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.seed = std::stoull(argv[++i]);
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --seed\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --seed requires a value\n";
+                return false;
+            }
+        }
+        else if (arg == "--frame")
+        {
+            if (i + 1 < argc)
+            {
+                try
+                {
+                    config.frame = std::stoull(argv[++i]);
+                }
+                catch (...)
+                {
+                    std::cerr << "Error: Invalid value for --frame\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Error: --frame requires a value\n";
+                return false;
+            }
+        }
         else
         {
             std::cerr << "Error: Unrecognized argument '" << arg << "'\n\n";
@@ -302,6 +817,23 @@ bool parse_arguments(int argc, char* argv[], camera_config& config)
             return false;
         }
     }
+
+    // Each of these only exists in one integrator
+    if (config.wavefront && config.packet_size > 0)
+    {
+        std::cerr << "Error: --packets requires --integrator path\n";
+        return false;
+    }
+    if (config.sort_rays && !config.wavefront)
+    {
+        std::cerr << "Error: --sort-rays requires --integrator wavefront\n";
+        return false;
+    }
+
+    if (!format_given)
+    {
+        config.output_format = image_format_from_path(config.output_path, config.output_format);
+    }
     
     return true;
 }
@@ -0,0 +1,278 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CRC-32 as used by PNG chunks and gzip, continuing from crc (0 for a fresh checksum)
+inline uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    struct crc_table
+    {
+        uint32_t entries[256];
+
+        crc_table()
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    };
+    static const crc_table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static const uint32_t adler_modulus = 65521;
+
+// Adler-32 as used by zlib streams, continuing from adler (1 for a fresh checksum)
+inline uint32_t adler32(const unsigned char* data, size_t size, uint32_t adler = 1)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+
+    // 5552 is the most bytes that can be summed before b can overflow 32 bits
+    while (size > 0)
+    {
+        size_t block = (size < 5552) ? size : 5552;
+        size -= block;
+        for (size_t i = 0; i < block; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        data += block;
+        a %= adler_modulus;
+        b %= adler_modulus;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of the concatenation of two pieces from the checksums of each and the length of the
+// second, so pieces can be summed in parallel
+inline uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size)
+{
+    uint32_t remainder = uint32_t(second_size % adler_modulus);
+    uint32_t a = first & 0xffff;
+    uint32_t b = uint32_t((uint64_t(remainder) * a) % adler_modulus);
+
+    a += (second & 0xffff) + adler_modulus - 1;
+    b += (first >> 16) + (second >> 16) + adler_modulus - remainder;
+
+    if (a >= adler_modulus) a -= adler_modulus;
+    if (a >= adler_modulus) a -= adler_modulus;
+    if (b >= 2 * adler_modulus) b -= 2 * adler_modulus;
+    if (b >= adler_modulus) b -= adler_modulus;
+    return (b << 16) | a;
+}
+
+// Raw DEFLATE (RFC 1951) encoder: greedy LZ77 over hash chains, coded with the fixed Huffman
+// tables, so there are no code tables to build or store. Each call to compress encodes its input
+// as an independent piece that starts with an empty window; pieces that are not last end on a
+// byte boundary with an empty stored block, so compressed pieces can be concatenated into one
+// stream. That is what lets the PNG writer compress image stripes in parallel.
+class deflate_compressor
+{
+    public:
+        // Append the compressed input to out
+        void compress(const unsigned char* data, size_t size, bool last, std::vector<unsigned char>& out)
+        {
+            output = &out;
+            bit_buffer = 0;
+            bit_count = 0;
+
+            head.assign(hash_size, no_position);
+            chain.resize(window_size);
+
+            write_bits(last ? 1 : 0, 1);
+            write_bits(1, 2);   // Fixed Huffman codes
+
+            size_t position = 0;
+            while (position < size)
+            {
+                size_t best_length = 0;
+                size_t best_distance = 0;
+
+                if (position + min_match <= size)
+                {
+                    uint32_t hash = hash_at(data + position);
+                    size_t limit = (size - position < max_match) ? size - position : max_match;
+
+                    size_t candidate = head[hash];
+                    for (int steps = 0; candidate != no_position && steps < max_chain; steps++)
+                    {
+                        size_t distance = position - candidate;
+                        if (distance > window_size)
+                        {
+                            break;
+                        }
+
+                        if (data[candidate + best_length] == data[position + best_length])
+                        {
+                            size_t length = 0;
+                            while (length < limit && data[candidate + length] == data[position + length])
+                            {
+                                length++;
+                            }
+
+                            if (length > best_length)
+                            {
+                                best_length = length;
+                                best_distance = distance;
+                                if (length == limit)
+                                {
+                                    break;
+                                }
+                            }
+                        }
+                        candidate = chain[candidate % window_size];
+                    }
+                }
+
+                if (best_length >= min_match)
+                {
+                    write_match(best_length, best_distance);
+                    size_t end = position + best_length;
+                    for (; position < end; position++)
+                    {
+                        insert(data, size, position);
+                    }
+                }
+                else
+                {
+                    write_literal(data[position]);
+                    insert(data, size, position);
+                    position++;
+                }
+            }
+
+            write_literal(256);     // End of block
+
+            if (!last)
+            {
+                // Empty stored block, which pads to a byte boundary
+                write_bits(0, 3);
+                flush_to_byte();
+                output -> insert(output -> end(), {0x00, 0x00, 0xff, 0xff});
+            }
+            else
+            {
+                flush_to_byte();
+            }
+        }
+
+    private:
+        static constexpr size_t window_size = 32768;
+        static constexpr size_t min_match = 3;
+        static constexpr size_t max_match = 258;
+        static constexpr int max_chain = 32;        // Candidates tried per position
+        static constexpr int hash_bits = 15;
+        static constexpr size_t hash_size = size_t(1) << hash_bits;
+        static constexpr size_t no_position = ~size_t(0);
+
+        std::vector<size_t> head;       // Latest position per hash
+        std::vector<size_t> chain;      // Previous position with the same hash, by position mod window
+        std::vector<unsigned char>* output = nullptr;
+        uint64_t bit_buffer = 0;
+        int bit_count = 0;
+
+        static uint32_t hash_at(const unsigned char* bytes)
+        {
+            uint32_t value = uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16);
+            return (value * 2654435761u) >> (32 - hash_bits);
+        }
+
+        void insert(const unsigned char* data, size_t size, size_t position)
+        {
+            if (position + min_match <= size)
+            {
+                uint32_t hash = hash_at(data + position);
+                chain[position % window_size] = head[hash];
+                head[hash] = position;
+            }
+        }
+
+        // DEFLATE packs bits starting from the least significant bit of each byte
+        void write_bits(uint32_t value, int count)
+        {
+            bit_buffer |= uint64_t(value) << bit_count;
+            bit_count += count;
+            while (bit_count >= 8)
+            {
+                output -> push_back((unsigned char)(bit_buffer & 0xff));
+                bit_buffer >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        // Huffman codes are stored most significant bit first
+        void write_code(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int bit = 0; bit < length; bit++)
+            {
+                reversed = (reversed << 1) | ((code >> bit) & 1);
+            }
+            write_bits(reversed, length);
+        }
+
+        void flush_to_byte()
+        {
+            if (bit_count > 0)
+            {
+                write_bits(0, 8 - bit_count);
+            }
+        }
+
+        // Literal bytes and the end-of-block and length symbols share the fixed literal/length code
+        void write_literal(uint32_t symbol)
+        {
+            if (symbol < 144)       write_code(0x30 + symbol, 8);
+            else if (symbol < 256)  write_code(0x190 + symbol - 144, 9);
+            else if (symbol < 280)  write_code(symbol - 256, 7);
+            else                    write_code(0xc0 + symbol - 280, 8);
+        }
+
+        void write_match(size_t length, size_t distance)
+        {
+            static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                                       8193, 12289, 16385, 24577};
+            static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+            int length_code = 28;
+            while (length_base[length_code] > length)
+            {
+                length_code--;
+            }
+            write_literal(257 + length_code);
+            write_bits(uint32_t(length - length_base[length_code]), length_extra[length_code]);
+
+            int distance_code = 29;
+            while (distance_base[distance_code] > distance)
+            {
+                distance_code--;
+            }
+            write_code(distance_code, 5);
+            write_bits(uint32_t(distance - distance_base[distance_code]), distance_extra[distance_code]);
+        }
+};
+
+#endif
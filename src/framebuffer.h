@@ -0,0 +1,142 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+// Flat RGB image in a single cache-line-aligned allocation. Every row starts on a cache line, so
+// tiles whose width in bytes is a multiple of the line size never share a line with a
+// neighbouring tile and workers writing adjacent tiles do not false-share.
+template <typename T>
+class basic_framebuffer
+{
+    public:
+        using value_type = T;
+
+        static constexpr size_t cache_line_size = 64;
+        static constexpr int channels = 3;
+
+        // A rectangular window into the framebuffer, owned by one worker while it renders a tile.
+        // Coordinates passed to it are relative to the tile origin.
+        class tile_view
+        {
+            public:
+                int x0, y0;         // Tile origin in image coordinates
+                int width, height;
+
+                tile_view(T* origin, size_t row_stride, int x0, int y0, int width, int height)
+                    : x0(x0), y0(y0), width(width), height(height), origin(origin), row_stride(row_stride) {}
+
+                T* row(int local_y) const
+                {
+                    return origin + local_y * row_stride;
+                }
+
+                void set(int local_x, int local_y, const colour& pixel_colour) const
+                {
+                    T* pixel = row(local_y) + local_x * channels;
+                    pixel[0] = T(pixel_colour.get_x());
+                    pixel[1] = T(pixel_colour.get_y());
+                    pixel[2] = T(pixel_colour.get_z());
+                }
+
+                colour get(int local_x, int local_y) const
+                {
+                    const T* pixel = row(local_y) + local_x * channels;
+                    return colour(pixel[0], pixel[1], pixel[2]);
+                }
+
+            private:
+                T* origin;
+                size_t row_stride;  // In elements of T
+        };
+
+        basic_framebuffer() {}
+
+        basic_framebuffer(int width, int height)
+        {
+            resize(width, height);
+        }
+
+        basic_framebuffer(const basic_framebuffer&) = delete;
+        basic_framebuffer& operator=(const basic_framebuffer&) = delete;
+
+        ~basic_framebuffer()
+        {
+            release();
+        }
+
+        // Set the image dimensions. The existing allocation is reused whenever it is big enough,
+        // so rendering frame after frame at the same resolution does not touch the heap.
+        void resize(int width, int height)
+        {
+            size_t row_bytes = size_t(width) * channels * sizeof(T);
+            row_bytes = (row_bytes + cache_line_size - 1) / cache_line_size * cache_line_size;
+
+            size_t required = row_bytes * size_t(height);
+            if (required > capacity_bytes)
+            {
+                release();
+                data = static_cast<T*>(::operator new(required, std::align_val_t(cache_line_size)));
+                capacity_bytes = required;
+            }
+
+            image_width = width;
+            image_height = height;
+            row_stride = row_bytes / sizeof(T);
+        }
+
+        int width() const { return image_width; }
+        int height() const { return image_height; }
+        size_t stride() const { return row_stride; }
+
+        T* row(int y) { return data + y * row_stride; }
+        const T* row(int y) const { return data + y * row_stride; }
+
+        void set(int x, int y, const colour& pixel_colour)
+        {
+            T* pixel = row(y) + x * channels;
+            pixel[0] = T(pixel_colour.get_x());
+            pixel[1] = T(pixel_colour.get_y());
+            pixel[2] = T(pixel_colour.get_z());
+        }
+
+        colour get(int x, int y) const
+        {
+            const T* pixel = row(y) + x * channels;
+            return colour(pixel[0], pixel[1], pixel[2]);
+        }
+
+        // Hand out the window [x0, x0 + width) x [y0, y0 + height), clipped to the image.
+        tile_view tile(int x0, int y0, int width, int height)
+        {
+            width = std::min(width, image_width - x0);
+            height = std::min(height, image_height - y0);
+            return tile_view(row(y0) + x0 * channels, row_stride, x0, y0, width, height);
+        }
+
+    private:
+        T* data = nullptr;
+        size_t capacity_bytes = 0;
+        size_t row_stride = 0;
+        int image_width = 0;
+        int image_height = 0;
+
+        void release()
+        {
+            if (data)
+            {
+                ::operator delete(data, std::align_val_t(cache_line_size));
+                data = nullptr;
+                capacity_bytes = 0;
+            }
+        }
+};
+
+using framebuffer = basic_framebuffer<double>;
+using framebuffer_f32 = basic_framebuffer<float>;
+
+#endif
@@ -4,17 +4,32 @@
 #include "rtweekend.h"
 #include "aabb.h"
 
-class material;
+#include <cstdint>
+
+class hittable;
+
+// Index of a material in the scene's material_table
+using material_id = uint32_t;
 
 class hit_record
 {
     public:
         point3 intersection_point;
         vec3 surface_normal;
-        shared_ptr<material> mat;
+        material_id mat;
         double t;
         bool front_face;
 
+        // How far intersection_point may be off the true surface. Rays leaving the surface start
+        // this far out along the normal, so they cannot hit it again at a tiny t. Shapes set it
+        // in surface(); 0 means the point is exact.
+        double offset = 0;
+
+        // Set by hittable::intersect: the object that was hit and, for objects holding many
+        // primitives, which one. hittable::surface uses them to fill in the rest.
+        const hittable* object;
+        size_t primitive;
+
         void set_face_normal(const ray& ray_obj, const vec3& outward_normal)
         {
             // Sets the hit record normal vector
@@ -23,6 +38,14 @@ class hit_record
             front_face = dot(ray_obj.get_direction(), outward_normal) < 0;
             surface_normal = front_face ? outward_normal : -outward_normal;
         }
+
+        // A ray leaving the surface in the given direction, its origin pushed off the surface to
+        // the side the direction points to
+        ray spawn_ray(const vec3& direction, double time) const
+        {
+            double side = (dot(direction, surface_normal) > 0) ? offset : -offset;
+            return ray(intersection_point + side * surface_normal, direction, time);
+        }
 };
 
 class hittable
@@ -30,11 +53,30 @@ class hittable
     public:
         virtual ~hittable() = default;
 
-        virtual bool hit(const ray& ray_obj,
-                         interval ray_interval,
-                         hit_record& record) const = 0;
+        // Find the closest hit within ray_interval, recording only record.t, record.object and
+        // record.primitive, and leave the record untouched on a miss. Candidates overtaken by a
+        // closer hit then cost no shading setup.
+        virtual bool intersect(const ray& ray_obj,
+                               interval ray_interval,
+                               hit_record& record) const = 0;
+
+        // Fill in the intersection point, normal and material for a hit that intersect() found
+        // on this object. Only called on record.object, so aggregates never need it.
+        virtual void surface(const ray&, hit_record&) const {}
 
         virtual aabb bounding_box() const = 0;
+
+        // Closest hit with the full record, built once for the final hit
+        bool hit(const ray& ray_obj, interval ray_interval, hit_record& record) const
+        {
+            if (!intersect(ray_obj, ray_interval, record))
+            {
+                return false;
+            }
+
+            record.object -> surface(ray_obj, record);
+            return true;
+        }
 };
 
 #endif
\ No newline at end of file
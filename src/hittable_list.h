@@ -23,21 +23,20 @@ class hittable_list : public hittable
             bbox = aabb(bbox, object -> bounding_box());
         }
 
-        bool hit(const ray& ray_obj,
-                 interval ray_interval,
-                 hit_record& record) const override 
+        bool intersect(const ray& ray_obj,
+                       interval ray_interval,
+                       hit_record& record) const override 
         {
-            hit_record temp_record;
             bool hit_anything = false;
             auto closest_so_far = ray_interval.max;
 
+            // A miss leaves the record alone, so each closer hit can write straight into it
             for (const auto& object : objects)
             {
-                if (object->hit(ray_obj, interval(ray_interval.min, closest_so_far), temp_record))
+                if (object->intersect(ray_obj, interval(ray_interval.min, closest_so_far), record))
                 {
                     hit_anything = true;
-                    closest_so_far = temp_record.t;
-                    record = temp_record;
+                    closest_so_far = record.t;
                 }
             }
 
@@ -49,6 +48,52 @@ class hittable_list : public hittable
             return bbox;
         }
 
+        // Primitive-set interface used when a BVH is built over the list
+
+        size_t size() const
+        {
+            return objects.size();
+        }
+
+        aabb bounding_box(size_t index) const
+        {
+            return objects[index] -> bounding_box();
+        }
+
+        // Permute the objects so that the one at order[i] moves to index i
+        void reorder(const std::vector<size_t>& order)
+        {
+            std::vector<shared_ptr<hittable>> reordered;
+            reordered.reserve(order.size());
+            for (size_t index : order)
+            {
+                reordered.push_back(objects[index]);
+            }
+            objects = std::move(reordered);
+        }
+
+        // Closest hit among objects [first, first + count); shrinks ray_interval.max on a hit
+        bool hit_range(const ray& ray_obj, interval& ray_interval, size_t first, size_t count,
+                       hit_record& record) const
+        {
+            bool hit_anything = false;
+            for (size_t i = first; i < first + count; i++)
+            {
+                if (objects[i] -> intersect(ray_obj, ray_interval, record))
+                {
+                    hit_anything = true;
+                    ray_interval.max = record.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        // Complete a record from hit_range: the object hit is a custom shape, reached virtually
+        void finish_hit(const ray& ray_obj, hit_record& record) const
+        {
+            record.object -> surface(ray_obj, record);
+        }
+
     private:
         aabb bbox;
 };
@@ -0,0 +1,548 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "deflate.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+enum class image_format
+{
+    ppm,            // Binary P6, 8 bits per channel
+    ppm_16,         // Binary P6, 16 bits per channel, most significant byte first
+    ppm_ascii,      // Plain-text P3, 8 bits per channel
+    png,            // 8-bit RGB PNG
+    hdr,            // Radiance RGBE: linear, unclamped radiance with a shared exponent
+    exr             // OpenEXR, uncompressed 32-bit float RGB: linear, unclamped radiance
+};
+
+// The format named on the command line. Returns false for an unknown name.
+inline bool image_format_from_name(const std::string& name, image_format& format)
+{
+    if (name == "ppm")              format = image_format::ppm;
+    else if (name == "ppm16")       format = image_format::ppm_16;
+    else if (name == "ppm-ascii")   format = image_format::ppm_ascii;
+    else if (name == "png")         format = image_format::png;
+    else if (name == "hdr")         format = image_format::hdr;
+    else if (name == "exr")         format = image_format::exr;
+    else return false;
+    return true;
+}
+
+// The format implied by a file extension, or fallback when it names none
+inline image_format image_format_from_path(const std::string& path, image_format fallback)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return fallback;
+    }
+
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+
+    if (extension == "ppm") return image_format::ppm;
+    if (extension == "png") return image_format::png;
+    if (extension == "hdr") return image_format::hdr;
+    if (extension == "exr") return image_format::exr;
+    return fallback;
+}
+
+inline const char* image_format_extension(image_format format)
+{
+    switch (format)
+    {
+        case image_format::png: return ".png";
+        case image_format::hdr: return ".hdr";
+        case image_format::exr: return ".exr";
+        default:                return ".ppm";
+    }
+}
+
+// path with its extension, if any, replaced by suffix
+inline std::string replace_extension(const std::string& path, const std::string& suffix)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return path + suffix;
+    }
+    return path.substr(0, dot) + suffix;
+}
+
+// Whether the format stores linear radiance rather than display levels
+inline bool is_float_format(image_format format)
+{
+    return format == image_format::hdr || format == image_format::exr;
+}
+
+// Encode a whole PPM file, header included, into one buffer. level(x, y, channel, max_value)
+// gives each sample as an integer in [0, max_value]. The samples are quantised row by row
+// straight into the buffer rather than formatted through a stream one pixel at a time.
+template <typename Level>
+std::vector<char> encode_ppm(int width, int height, image_format format, const Level& level)
+{
+    int max_value = (format == image_format::ppm_16) ? 65535 : 255;
+    std::string header = std::string(format == image_format::ppm_ascii ? "P3" : "P6") + '\n'
+                       + std::to_string(width) + ' ' + std::to_string(height) + '\n'
+                       + std::to_string(max_value) + '\n';
+
+    std::vector<char> bytes(header.begin(), header.end());
+    size_t sample_count = size_t(width) * height * 3;
+
+    if (format == image_format::ppm_ascii)
+    {
+        // At most "255 255 255\n" per pixel
+        size_t position = bytes.size();
+        bytes.resize(position + sample_count * 4);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    char* end = std::to_chars(&bytes[position], &bytes[position] + 3, level(x, y, channel, max_value)).ptr;
+                    *end = (channel < 2) ? ' ' : '\n';
+                    position = size_t(end - bytes.data()) + 1;
+                }
+            }
+        }
+        bytes.resize(position);
+        return bytes;
+    }
+
+    size_t bytes_per_sample = (max_value > 255) ? 2 : 1;
+    size_t position = bytes.size();
+    bytes.resize(position + sample_count * bytes_per_sample);
+    unsigned char* out = reinterpret_cast<unsigned char*>(&bytes[position]);
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            for (int channel = 0; channel < 3; channel++)
+            {
+                int value = level(x, y, channel, max_value);
+                if (bytes_per_sample == 2)
+                {
+                    *out++ = (unsigned char)(value >> 8);
+                }
+                *out++ = (unsigned char)(value & 0xff);
+            }
+        }
+    }
+
+    return bytes;
+}
+
+namespace image_bytes
+{
+    inline void put_u32_big(std::vector<char>& out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            out.push_back(char((value >> shift) & 0xff));
+        }
+    }
+
+    inline void put_u32_little(std::vector<char>& out, uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            out.push_back(char((value >> shift) & 0xff));
+        }
+    }
+
+    inline void put_u64_little(std::vector<char>& out, uint64_t value)
+    {
+        put_u32_little(out, uint32_t(value));
+        put_u32_little(out, uint32_t(value >> 32));
+    }
+
+    inline void put_float_little(std::vector<char>& out, float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put_u32_little(out, bits);
+    }
+
+    inline void put_string(std::vector<char>& out, const std::string& text)
+    {
+        out.insert(out.end(), text.begin(), text.end());
+    }
+}
+
+// PNG chunk: length, type, data, then the CRC of type and data
+inline void append_png_chunk(std::vector<char>& out, const char* type, const unsigned char* data, size_t size)
+{
+    image_bytes::put_u32_big(out, uint32_t(size));
+    size_t type_start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+
+    const unsigned char* checked = reinterpret_cast<const unsigned char*>(out.data()) + type_start;
+    image_bytes::put_u32_big(out, crc32(checked, size + 4));
+}
+
+// Apply PNG filter type filter (0 none, 1 sub, 2 up, 3 average, 4 Paeth) to an RGB row, given
+// the row above (null for the first row). Returns the sum of the filtered bytes as signed
+// magnitudes.
+inline uint64_t png_filter_row(int filter, const unsigned char* row, const unsigned char* above, size_t size,
+                               unsigned char* out)
+{
+    auto predict = [&](const auto& predictor)
+    {
+        uint64_t cost = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            int a = (i >= 3) ? row[i - 3] : 0;
+            int b = above ? above[i] : 0;
+            int c = (above && i >= 3) ? above[i - 3] : 0;
+            unsigned char value = (unsigned char)(row[i] - predictor(a, b, c));
+            out[i] = value;
+            cost += (value < 128) ? value : 256 - value;
+        }
+        return cost;
+    };
+
+    switch (filter)
+    {
+        case 1:  return predict([](int a, int, int) { return a; });
+        case 2:  return predict([](int, int b, int) { return b; });
+        case 3:  return predict([](int a, int b, int) { return (a + b) / 2; });
+        case 4:  return predict([](int a, int b, int c)
+                 {
+                     int p = a + b - c;
+                     int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                     return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+                 });
+        default: return predict([](int, int, int) { return 0; });
+    }
+}
+
+// Encode an 8-bit RGB PNG. level(x, y, channel, max_value) gives each sample, as for encode_ppm.
+//
+// The image is cut into stripes of rows, sized by bytes so the file does not depend on the
+// thread count. Each stripe is filtered and deflated as an independent piece of the zlib stream
+// and stored as its own IDAT chunk, so with a pool every step after quantisation
+// (filtering, compression, Adler-32 and the chunk CRC) runs in parallel. The per-stripe Adler
+// sums are combined at the end.
+template <typename Level>
+std::vector<char> encode_png(int width, int height, const Level& level, thread_pool* pool = nullptr)
+{
+    const size_t row_bytes = size_t(width) * 3;
+    const size_t stripe_target_bytes = size_t(1) << 18;
+    const int stripe_rows = int(std::max<size_t>(1, stripe_target_bytes / (row_bytes + 1)));
+    const int stripe_count = (height + stripe_rows - 1) / stripe_rows;
+
+    auto for_each_stripe = [&](const auto& body)
+    {
+        if (pool)
+        {
+            parallel_for(*pool, size_t(stripe_count), [&](size_t stripe) { body(int(stripe)); });
+        }
+        else
+        {
+            for (int stripe = 0; stripe < stripe_count; stripe++)
+            {
+                body(stripe);
+            }
+        }
+    };
+
+    // Quantise every row first: filtering a stripe's first row needs the row above it
+    std::vector<unsigned char> pixels(row_bytes * height);
+    for_each_stripe([&](int stripe)
+    {
+        int row_end = std::min(height, (stripe + 1) * stripe_rows);
+        for (int y = stripe * stripe_rows; y < row_end; y++)
+        {
+            unsigned char* row = &pixels[row_bytes * y];
+            for (int x = 0; x < width; x++)
+            {
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    row[x * 3 + channel] = (unsigned char)level(x, y, channel, 255);
+                }
+            }
+        }
+    });
+
+    struct stripe_result
+    {
+        std::vector<unsigned char> chunk;   // IDAT data: deflated, filtered rows
+        uint32_t adler;
+        size_t filtered_size;
+    };
+    std::vector<stripe_result> stripes(stripe_count);
+
+    for_each_stripe([&](int stripe)
+    {
+        int row_begin = stripe * stripe_rows;
+        int row_end = std::min(height, row_begin + stripe_rows);
+
+        std::vector<unsigned char> filtered((row_bytes + 1) * (row_end - row_begin));
+        std::vector<unsigned char> candidate(row_bytes);
+        for (int y = row_begin; y < row_end; y++)
+        {
+            const unsigned char* row = &pixels[row_bytes * y];
+            const unsigned char* above = (y > 0) ? &pixels[row_bytes * (y - 1)] : nullptr;
+            unsigned char* out = &filtered[(row_bytes + 1) * (y - row_begin)];
+
+            // Try every filter type and keep the one with the smallest sum of absolute
+            // differences, the usual heuristic for which will deflate best
+            uint64_t best_cost = ~uint64_t(0);
+            for (int filter = 0; filter < 5; filter++)
+            {
+                uint64_t cost = png_filter_row(filter, row, above, row_bytes, candidate.data());
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    out[0] = (unsigned char)filter;
+                    std::copy(candidate.begin(), candidate.end(), out + 1);
+                }
+            }
+        }
+
+        stripe_result& result = stripes[stripe];
+        bool first = stripe == 0;
+        bool last = stripe == stripe_count - 1;
+        if (first)
+        {
+            // zlib header: deflate with a 32K window, no preset dictionary
+            result.chunk = {0x78, 0x01};
+        }
+        deflate_compressor().compress(filtered.data(), filtered.size(), last, result.chunk);
+        result.adler = adler32(filtered.data(), filtered.size());
+        result.filtered_size = filtered.size();
+    });
+
+    uint32_t adler = 1;
+    for (const auto& result : stripes)
+    {
+        adler = adler32_combine(adler, result.adler, result.filtered_size);
+    }
+    if (stripe_count > 0)
+    {
+        auto& chunk = stripes.back().chunk;
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            chunk.push_back((unsigned char)((adler >> shift) & 0xff));
+        }
+    }
+
+    std::vector<char> bytes = {char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+    unsigned char header[13] = {};
+    for (int i = 0; i < 4; i++)
+    {
+        header[i] = (unsigned char)(uint32_t(width) >> (24 - 8 * i));
+        header[4 + i] = (unsigned char)(uint32_t(height) >> (24 - 8 * i));
+    }
+    header[8] = 8;      // Bits per channel
+    header[9] = 2;      // RGB
+    append_png_chunk(bytes, "IHDR", header, sizeof(header));
+
+    for (const auto& result : stripes)
+    {
+        append_png_chunk(bytes, "IDAT", result.chunk.data(), result.chunk.size());
+    }
+    append_png_chunk(bytes, "IEND", nullptr, 0);
+    return bytes;
+}
+
+// Encode the framebuffer's linear radiance, unclamped, as Radiance RGBE in flat scanlines
+template <typename T>
+std::vector<char> encode_hdr(const basic_framebuffer<T>& source)
+{
+    std::vector<char> bytes;
+    image_bytes::put_string(bytes, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(source.height())
+                                   + " +X " + std::to_string(source.width()) + "\n");
+
+    size_t position = bytes.size();
+    bytes.resize(position + size_t(source.width()) * source.height() * 4);
+    for (int y = 0; y < source.height(); y++)
+    {
+        const T* row = source.row(y);
+        for (int x = 0; x < source.width(); x++)
+        {
+            // Negative and NaN components cannot be stored; they become 0
+            double red = std::fmax(double(row[x * 3]), 0.0);
+            double green = std::fmax(double(row[x * 3 + 1]), 0.0);
+            double blue = std::fmax(double(row[x * 3 + 2]), 0.0);
+            double brightest = std::fmax(red, std::fmax(green, blue));
+
+            unsigned char* pixel = reinterpret_cast<unsigned char*>(&bytes[position]);
+            position += 4;
+            if (!(brightest >= 1e-32) || std::isinf(brightest))
+            {
+                pixel[0] = pixel[1] = pixel[2] = pixel[3] = 0;
+                continue;
+            }
+
+            int exponent;
+            double scale = std::frexp(brightest, &exponent) * 256.0 / brightest;
+            pixel[0] = (unsigned char)(red * scale);
+            pixel[1] = (unsigned char)(green * scale);
+            pixel[2] = (unsigned char)(blue * scale);
+            pixel[3] = (unsigned char)(exponent + 128);
+        }
+    }
+    return bytes;
+}
+
+// Encode the framebuffer's linear radiance, unclamped, as a single-part scanline OpenEXR file
+// with uncompressed 32-bit float B, G and R channels, one scanline per block
+template <typename T>
+std::vector<char> encode_exr(const basic_framebuffer<T>& source)
+{
+    using namespace image_bytes;
+    int width = source.width();
+    int height = source.height();
+
+    std::vector<char> bytes;
+    put_u32_little(bytes, 20000630);    // Magic number
+    put_u32_little(bytes, 2);           // Version 2, single-part scanline
+
+    auto attribute = [&](const char* name, const char* type, uint32_t size)
+    {
+        put_string(bytes, name);
+        bytes.push_back(0);
+        put_string(bytes, type);
+        bytes.push_back(0);
+        put_u32_little(bytes, size);
+    };
+
+    // Channels are listed, and stored, in alphabetical order
+    attribute("channels", "chlist", 3 * 18 + 1);
+    for (const char* channel : {"B", "G", "R"})
+    {
+        put_string(bytes, channel);
+        bytes.push_back(0);
+        put_u32_little(bytes, 2);       // FLOAT
+        put_u32_little(bytes, 0);       // pLinear and reserved bytes
+        put_u32_little(bytes, 1);       // x sampling
+        put_u32_little(bytes, 1);       // y sampling
+    }
+    bytes.push_back(0);
+
+    attribute("compression", "compression", 1);
+    bytes.push_back(0);                 // NO_COMPRESSION
+
+    for (const char* window : {"dataWindow", "displayWindow"})
+    {
+        attribute(window, "box2i", 16);
+        put_u32_little(bytes, 0);
+        put_u32_little(bytes, 0);
+        put_u32_little(bytes, uint32_t(width - 1));
+        put_u32_little(bytes, uint32_t(height - 1));
+    }
+
+    attribute("lineOrder", "lineOrder", 1);
+    bytes.push_back(0);                 // INCREASING_Y
+
+    attribute("pixelAspectRatio", "float", 4);
+    put_float_little(bytes, 1.0f);
+
+    attribute("screenWindowCenter", "v2f", 8);
+    put_float_little(bytes, 0.0f);
+    put_float_little(bytes, 0.0f);
+
+    attribute("screenWindowWidth", "float", 4);
+    put_float_little(bytes, 1.0f);
+
+    bytes.push_back(0);                 // End of header
+
+    // Offset table, then each scanline: its y, its size in bytes and the B, G and R rows
+    uint32_t line_bytes = uint32_t(width) * 3 * 4;
+    uint64_t line_start = bytes.size() + uint64_t(height) * 8;
+    for (int y = 0; y < height; y++)
+    {
+        put_u64_little(bytes, line_start + uint64_t(y) * (8 + line_bytes));
+    }
+
+    size_t position = bytes.size();
+    bytes.resize(position + size_t(height) * (8 + line_bytes));
+    unsigned char* out = reinterpret_cast<unsigned char*>(&bytes[position]);
+    auto store = [&](uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            *out++ = (unsigned char)((value >> shift) & 0xff);
+        }
+    };
+
+    for (int y = 0; y < height; y++)
+    {
+        store(uint32_t(y));
+        store(line_bytes);
+
+        const T* row = source.row(y);
+        for (int channel = 2; channel >= 0; channel--)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                float value = float(row[x * 3 + channel]);
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                store(bits);
+            }
+        }
+    }
+    return bytes;
+}
+
+// Encode the framebuffer's linear radiance as HDR or EXR. The integer formats store display
+// levels, which come from display_transform and are written with encode_levels.
+template <typename T>
+std::vector<char> encode_float_image(const basic_framebuffer<T>& source, image_format format)
+{
+    return (format == image_format::hdr) ? encode_hdr(source) : encode_exr(source);
+}
+
+// Encode levels already quantised to the format's range, three per pixel, row-major, as PPM or
+// PNG
+inline std::vector<char> encode_levels(int width, int height, const uint16_t* levels, image_format format,
+                                       thread_pool* pool = nullptr)
+{
+    auto level = [&](int x, int y, int channel, int)
+    {
+        return int(levels[(size_t(y) * width + x) * 3 + channel]);
+    };
+
+    if (format == image_format::png)
+    {
+        return encode_png(width, height, level, pool);
+    }
+    return encode_ppm(width, height, format, level);
+}
+
+// Write the whole file with a single write call
+inline bool write_file(const std::string& path, const std::vector<char>& bytes)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), std::streamsize(bytes.size()));
+
+    if (!file)
+    {
+        std::cerr << "Error: could not write " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
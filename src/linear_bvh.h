@@ -0,0 +1,297 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "ray_packet.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// One BVH node packed into 32 bytes, so two share a cache line. Bounds are stored as floats,
+// rounded outwards so they still enclose the double-precision boxes they were built from.
+struct alignas(32) linear_bvh_node
+{
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;            // Leaf: first primitive. Interior: index of the second child.
+    uint16_t primitive_count;   // 0 for interior nodes
+    uint8_t axis;               // Interior: split axis, used to visit the nearer child first
+    uint8_t padding;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+// Bounding volume hierarchy flattened into one contiguous array in depth-first order. The first
+// child of an interior node is always the next node in the array, so only the second child's
+// index needs storing. Traversal is a loop over an explicit stack rather than recursive virtual
+// calls, and it visits the child nearer the ray origin first so far subtrees are culled by the
+// shrinking hit interval.
+//
+// Primitives is the storage the leaves index into: hittable_list for arbitrary objects, or a
+// batch type such as sphere_batch. It must provide size(), bounding_box(index), reorder(order),
+// hit_range(ray, interval&, first, count, record) and finish_hit(ray, record).
+template <typename Primitives = hittable_list>
+class linear_bvh final : public hittable
+{
+    public:
+        static constexpr int max_depth = bvh_builder::max_depth;    // Also the size of the traversal stack
+
+        // Takes over the primitives and reorders them into leaf order. With a pool, the build runs
+        // as parallel tasks on it.
+        linear_bvh(Primitives primitive_set, const bvh_build_options& build_options = bvh_build_options(),
+                   thread_pool* pool = nullptr)
+            : primitives(std::move(primitive_set)), options(build_options)
+        {
+            std::vector<aabb> boxes(primitives.size());
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                boxes[i] = primitives.bounding_box(i);
+            }
+
+            // The build tree only lives until it has been flattened
+            arena build_nodes;
+            bvh_build_result tree = bvh_builder(options, pool).build(boxes, build_nodes);
+            primitives.reorder(tree.primitive_order);
+
+            nodes.reserve(tree.node_count);
+            if (tree.root)
+            {
+                flatten(*tree.root);
+                bbox = tree.root -> box;
+            }
+        }
+
+        bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+        {
+            if (nodes.empty())
+            {
+                return false;
+            }
+
+            uint32_t stack[max_depth];
+            int stack_size = 0;
+            uint32_t current = 0;
+            bool hit_anything = false;
+
+            while (true)
+            {
+                const linear_bvh_node& node = nodes[current];
+
+                if (node_hit(node, r, ray_t))
+                {
+                    if (node.primitive_count > 0)
+                    {
+                        if (primitives.hit_range(r, ray_t, node.offset, node.primitive_count, rec))
+                        {
+                            hit_anything = true;
+                        }
+
+                        if (stack_size == 0) break;
+                        current = stack[--stack_size];
+                    }
+                    else if (r.direction_is_negative(node.axis))
+                    {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                }
+                else
+                {
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+            }
+
+            return hit_anything;
+        }
+
+        // Closest hits for a packet of rays through one shared stack, nearer child first by the
+        // packet's common direction. Each node is culled against the packet's frustum, then
+        // slab-tested against the rays that reached it at once. The packet must be coherent.
+        // Returns the rays whose record got a closer hit.
+        uint64_t intersect_packet(ray_packet& packet) const
+        {
+            uint64_t improved = 0;
+            if (nodes.empty())
+            {
+                return improved;
+            }
+
+            struct packet_stack_entry
+            {
+                uint32_t index;
+                uint64_t rays;      // The packet's rays that hit the parent
+            };
+
+            packet_stack_entry stack[max_depth];
+            int stack_size = 0;
+            packet_stack_entry current = {0, packet.all_rays()};
+
+            while (true)
+            {
+                const linear_bvh_node& node = nodes[current.index];
+
+                const float* node_min[3] = {&node.bounds_min[0], &node.bounds_min[1], &node.bounds_min[2]};
+                const float* node_max[3] = {&node.bounds_max[0], &node.bounds_max[1], &node.bounds_max[2]};
+                float t_near;
+                uint64_t rays = packet.frustum_may_hit<1>(node_min, node_max)
+                              ? packet.intersect_box(node.bounds_min, node.bounds_max, current.rays, t_near)
+                              : 0;
+
+                if (rays != 0 && node.primitive_count == 0)
+                {
+                    if (packet.direction_is_negative[node.axis])
+                    {
+                        stack[stack_size++] = {current.index + 1, rays};
+                        current = {node.offset, rays};
+                    }
+                    else
+                    {
+                        stack[stack_size++] = {node.offset, rays};
+                        current = {current.index + 1, rays};
+                    }
+                    continue;
+                }
+
+                while (rays != 0)
+                {
+                    int i = lowest_bit(rays);
+                    rays &= rays - 1;
+
+                    interval ray_t(0, packet.t_max[i]);
+                    if (primitives.hit_range(packet.rays[i], ray_t, node.offset, node.primitive_count, packet.records[i]))
+                    {
+                        packet.shrink(i, ray_t.max);
+                        improved |= uint64_t(1) << i;
+                    }
+                }
+
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+
+            return improved;
+        }
+
+        aabb bounding_box() const override
+        {
+            return bbox;
+        }
+
+        size_t node_count() const
+        {
+            return nodes.size();
+        }
+
+        const Primitives& leaf_primitives() const
+        {
+            return primitives;
+        }
+
+        // Expected cost of tracing a ray through the finished tree under the surface area
+        // heuristic: each node is weighted by the probability that a ray hitting the root also
+        // hits it, interior nodes cost traversal_cost and leaves one unit per primitive.
+        double sah_cost() const
+        {
+            if (nodes.empty())
+            {
+                return 0;
+            }
+
+            double root_area = node_box(nodes[0]).surface_area();
+            if (root_area <= 0)
+            {
+                return 0;
+            }
+
+            double cost = 0;
+            for (const auto& node : nodes)
+            {
+                double weight = (node.primitive_count > 0) ? node.primitive_count : options.traversal_cost;
+                cost += weight * node_box(node).surface_area() / root_area;
+            }
+            return cost;
+        }
+
+    private:
+        std::vector<linear_bvh_node> nodes;
+        Primitives primitives;      // In leaf order
+        bvh_build_options options;
+        aabb bbox;
+
+        static aabb node_box(const linear_bvh_node& node)
+        {
+            return aabb(interval(node.bounds_min[0], node.bounds_max[0]),
+                        interval(node.bounds_min[1], node.bounds_max[1]),
+                        interval(node.bounds_min[2], node.bounds_max[2]));
+        }
+
+        // Branchless slab test against the node's float bounds. The ray's sign bits pick which
+        // plane of each slab is entered first, so no per-axis swap is needed, and the interval is
+        // narrowed with comparisons that are false for NaN: a zero direction component with the
+        // origin on a slab plane gives 0 * inf = NaN, which then leaves the interval untouched.
+        static bool node_hit(const linear_bvh_node& node, const ray& r, interval ray_t)
+        {
+            const point3& origin = r.get_origin();
+            const vec3& inverse_direction = r.get_inverse_direction();
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                bool negative = r.direction_is_negative(axis);
+                double t_near = ((negative ? node.bounds_max[axis] : node.bounds_min[axis]) - origin[axis]) * inverse_direction[axis];
+                double t_far = ((negative ? node.bounds_min[axis] : node.bounds_max[axis]) - origin[axis]) * inverse_direction[axis];
+                t_far *= aabb::far_scale;
+
+                ray_t.min = (t_near > ray_t.min) ? t_near : ray_t.min;
+                ray_t.max = (t_far < ray_t.max) ? t_far : ray_t.max;
+            }
+
+            return ray_t.min <= ray_t.max;
+        }
+
+        // Append the subtree in depth-first order and return its node index. The first child
+        // lands directly after its parent; the second child's index is patched in afterwards.
+        uint32_t flatten(const bvh_build_node& build_node)
+        {
+            uint32_t node_index = uint32_t(nodes.size());
+            nodes.emplace_back();
+
+            linear_bvh_node node;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                node.bounds_min[axis] = float_round_down(build_node.box.axis_interval(axis).min);
+                node.bounds_max[axis] = float_round_up(build_node.box.axis_interval(axis).max);
+            }
+            node.padding = 0;
+
+            if (build_node.is_leaf())
+            {
+                node.offset = uint32_t(build_node.first);
+                node.primitive_count = uint16_t(build_node.count);
+                node.axis = 0;
+            }
+            else
+            {
+                flatten(*build_node.children[0]);
+                node.offset = flatten(*build_node.children[1]);
+                node.primitive_count = 0;
+                node.axis = uint8_t(build_node.axis);
+            }
+
+            nodes[node_index] = node;
+            return node_index;
+        }
+};
+
+#endif
@@ -1,12 +1,60 @@
 #include "rtweekend.h"
 
-#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "scene.h"
 #include "sphere.h"
+#include "sphere_batch.h"
 #include "camera.h"
 #include "material.h"
 #include "cmdline_parser.h"
+#include "sampler.h"
+#include "thread_pool.h"
+
+#include <chrono>
+
+// Build the scene over the given accelerator, then render it. The sphere batch and the custom
+// shapes (virtual hittables) each get their own BVH.
+template <template <typename> class accelerator, typename Spheres>
+void render_scene(const char* name, Spheres spheres, hittable_list& shapes, const material_table& materials,
+                  const bvh_build_options& bvh_options, camera& cam, thread_pool& pool)
+{
+    auto build_start = std::chrono::steady_clock::now();
+    scene<accelerator, Spheres, hittable_list> world(std::move(spheres), std::move(shapes), bvh_options, &pool);
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - build_start;
+
+    std::clog << name << ": " << world.node_count() << " nodes, SAH cost " << world.sah_cost()
+              << ", built in " << build_time.count() * 1000 << " ms\n";
+
+    auto render_start = std::chrono::steady_clock::now();
+    cam.render(world, materials, pool);
+    std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - render_start;
+
+    std::clog << "Rendered in " << render_time.count() << " s\n";
+
+    std::clog << "Traced " << cam.rays_traced() << " rays, "
+              << cam.rays_traced() / render_time.count() / 1e6 << " Mrays/s\n";
+}
+
+template <typename Spheres>
+void render_with_bvh(int bvh_width, Spheres spheres, hittable_list& shapes, const material_table& materials,
+                     const bvh_build_options& bvh_options, camera& cam, thread_pool& pool)
+{
+    if (bvh_width == 2)
+    {
+        render_scene<linear_bvh>("BVH2", std::move(spheres), shapes, materials, bvh_options, cam, pool);
+    }
+    else if (bvh_width == 4)
+    {
+        render_scene<bvh4>("BVH4", std::move(spheres), shapes, materials, bvh_options, cam, pool);
+    }
+    else
+    {
+        render_scene<bvh8>("BVH8", std::move(spheres), shapes, materials, bvh_options, cam, pool);
+    }
+}
 
 int main(int argc, char* argv[])
 {
@@ -16,13 +64,18 @@ int main(int argc, char* argv[])
         return 0;
     }
     
-    hittable_list world;
+    sphere_batch spheres;
+    hittable_list shapes;   // Anything that is not a sphere, as virtual hittables
+    material_table materials;
+
+    // Fixed seed so the scene layout is the same on every platform, whatever the render seed
+    sampler scene_rng(0);
     
-    // auto material_ground = make_shared<lambertian>(colour(0.8, 0.8, 0.0));
-    // auto material_center = make_shared<lambertian>(colour(0.1, 0.2, 0.5));
-    // auto material_left   = make_shared<dielectric>(1.50);
-    // auto material_bubble = make_shared<dielectric>(1.00 / 1.50);
-    // auto material_right  = make_shared<metal>(colour(0.8, 0.6, 0.2), 1.0);
+    // auto material_ground = materials.add<lambertian>(colour(0.8, 0.8, 0.0));
+    // auto material_center = materials.add<lambertian>(colour(0.1, 0.2, 0.5));
+    // auto material_left   = materials.add<dielectric>(1.50);
+    // auto material_bubble = materials.add<dielectric>(1.00 / 1.50);
+    // auto material_right  = materials.add<metal>(colour(0.8, 0.6, 0.2), 1.0);
     
     // world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
     // world.add(make_shared<sphere>(point3(0.0, 0.0, -1.2), 0.5, material_center));
@@ -30,63 +83,72 @@ int main(int argc, char* argv[])
     // world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.4, material_bubble));
     // world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
 
-    auto ground_material = make_shared<lambertian>(colour(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+    auto ground_material = materials.add<lambertian>(colour(0.5, 0.5, 0.5));
+    spheres.add(point3(0, -1000, 0), 1000, ground_material);
 
     for (int a = -11; a < 11; a++)
     {
         for (int b = -11; b < 11; b++)
         {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            auto choose_mat = scene_rng.random_double();
+            point3 center(a + 0.9 * scene_rng.random_double(), 0.2, b + 0.9 * scene_rng.random_double());
 
             if ((center - point3(4, 0.2, 0)).get_length() > 0.9)
             {
-                shared_ptr<material> sphere_material;
+                material_id sphere_material;
 
                 if (choose_mat < 0.8)
                 {
                     // Diffuse
-                    auto albedo = colour::get_random() * colour::get_random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+                    auto albedo = scene_rng.random_vec3() * scene_rng.random_vec3();
+                    sphere_material = materials.add<lambertian>(albedo);
+                    auto center2 = center + vec3(0, scene_rng.random_double(0, 0.5), 0);
+                    spheres.add(center, center2, 0.2, sphere_material);
                 }
                 else if (choose_mat < 0.95)
                 {
                     // Metal
-                    auto albedo = colour::get_random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    auto albedo = scene_rng.random_vec3(0.5, 1);
+                    auto fuzz = scene_rng.random_double(0, 0.5);
+                    sphere_material = materials.add<metal>(albedo, fuzz);
+                    spheres.add(center, 0.2, sphere_material);
                 }
                 else
                 {
                     // Glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = materials.add<dielectric>(1.5);
+                    spheres.add(center, 0.2, sphere_material);
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = materials.add<dielectric>(1.5);
+    spheres.add(point3(0, 1, 0), 1.0, material1);
 
-    auto material2 = make_shared<lambertian>(colour(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = materials.add<lambertian>(colour(0.4, 0.2, 0.1));
+    spheres.add(point3(-4, 1, 0), 1.0, material2);
 
-    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = materials.add<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    spheres.add(point3(4, 1, 0), 1.0, material3);
 
-    world = hittable_list(make_shared<bvh_node>(world));
+    bvh_build_options bvh_options;
+    bvh_options.split_method = config.bvh_sah ? bvh_split_method::sah : bvh_split_method::median;
+    bvh_options.bin_count = config.bvh_bins;
+    bvh_options.max_leaf_size = config.bvh_leaf_size;
 
     camera cam;
 
     cam.aspect_ratio = config.aspect_ratio;
     cam.image_width = config.image_width;
     cam.samples_per_pixel = config.samples_per_pixel;
+    cam.adaptive_threshold = config.adaptive_threshold;
+    cam.adaptive_min_samples = config.adaptive_min_samples;
     cam.max_depth = config.max_depth;
+    cam.rr_min_depth = config.rr_min_depth;
+    cam.wavefront = config.wavefront;
+    cam.sort_rays = config.sort_rays;
+    cam.packet_size = config.packet_size;
 
     cam.vfov = config.vfov;
     cam.look_from = config.look_from;
@@ -96,7 +158,26 @@ int main(int argc, char* argv[])
     cam.defocus_angle = config.defocus_angle;
     cam.focus_dist = config.focus_dist;
 
-    cam.render(world);
+    cam.tile_size = config.tile_size;
+    cam.float_framebuffer = config.float_framebuffer;
+    cam.output_path = config.output_path;
+    cam.output_format = config.output_format;
+    cam.display = config.display;
+
+    cam.seed = config.seed;
+    cam.frame = config.frame;
+
+    // One pool for the whole run: it builds the BVHs, then renders
+    thread_pool pool(config.threads);
+
+    if (config.single_precision)
+    {
+        render_with_bvh(config.bvh_width, sphere_batch_f32(spheres), shapes, materials, bvh_options, cam, pool);
+    }
+    else
+    {
+        render_with_bvh(config.bvh_width, std::move(spheres), shapes, materials, bvh_options, cam, pool);
+    }
 
     return 0;
 }
@@ -2,34 +2,16 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "sampler.h"
 
-#include <random>
+#include <utility>
+#include <variant>
+#include <vector>
 
-class material
-{
-    public:
-        virtual ~material() = default;
-
-        virtual bool scatter(const ray& ray_in,
-                             const hit_record& record,
-                             colour& attenuation,
-                             ray& scattered) const
-            {
-                return false;
-            }
+// Materials are plain value types with a non-virtual scatter. The scene's material_table holds
+// them in a variant, so evaluating one is a switch the compiler can inline into the bounce loop.
 
-        virtual bool scatter_thread_safe(const ray& ray_in,
-                                         const hit_record& record,
-                                         colour& attenuation,
-                                         ray& scattered,
-                                         std::mt19937& rng,
-                                         std::uniform_real_distribution<double>& dist) const
-            {
-                return false;
-            }
-};
-
-class lambertian : public material
+class lambertian
 {
     public:
         lambertian(const colour& albedo) : albedo(albedo) {}
@@ -37,10 +19,11 @@ class lambertian : public material
         bool scatter(const ray& ray_in, 
                      const hit_record& record, 
                      colour& attenuation, 
-                     ray& scattered)
-        const override
+                     ray& scattered,
+                     sampler& rng)
+        const
         {
-            auto scatter_direction = record.surface_normal + random_unit_vector();
+            auto scatter_direction = record.surface_normal + rng.random_unit_vector();
             
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
@@ -48,29 +31,7 @@ class lambertian : public material
                 scatter_direction = record.surface_normal;
             }
 
-            scattered = ray(record.intersection_point, scatter_direction, ray_in.time());
-            attenuation = albedo;
-            
-            return true;
-        }
-
-        bool scatter_thread_safe(const ray& ray_in, 
-                                 const hit_record& record, 
-                                 colour& attenuation, 
-                                 ray& scattered,
-                                 std::mt19937& rng,
-                                 std::uniform_real_distribution<double>& dist)
-        const override
-        {
-            auto scatter_direction = record.surface_normal + random_unit_vector_thread_safe(rng, dist);
-            
-            // Catch degenerate scatter direction
-            if (scatter_direction.near_zero())
-            {
-                scatter_direction = record.surface_normal;
-            }
-
-            scattered = ray(record.intersection_point, scatter_direction, ray_in.time());
+            scattered = record.spawn_ray(scatter_direction, ray_in.time());
             attenuation = albedo;
             
             return true;
@@ -78,22 +39,9 @@ class lambertian : public material
 
     private:
         colour albedo;
-
-        vec3 random_unit_vector_thread_safe(std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
-        {
-            while (true)
-            {
-                auto random_point = vec3(dist(rng) * 2.0 - 1.0, dist(rng) * 2.0 - 1.0, dist(rng) * 2.0 - 1.0);
-                auto squared_length = random_point.get_length_squared();
-                if (1e-160 < squared_length && squared_length <= 1)
-                {
-                    return random_point / sqrt(squared_length);
-                }
-            }
-        }
 };
 
-class metal : public material
+class metal
 {
     public:
         metal(const colour& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
@@ -101,28 +49,13 @@ class metal : public material
         bool scatter(const ray& ray_in,
                      const hit_record& record,
                      colour& attenuation,
-                     ray& scattered)
-        const override
-        {
-            vec3 reflected = reflect(ray_in.get_direction(), record.surface_normal);
-            reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-            scattered = ray(record.intersection_point, reflected, ray_in.time());
-            attenuation = albedo;
-
-            return (dot(scattered.get_direction(), record.surface_normal) > 0);
-        }
-
-        bool scatter_thread_safe(const ray& ray_in,
-                                 const hit_record& record,
-                                 colour& attenuation,
-                                 ray& scattered,
-                                 std::mt19937& rng,
-                                 std::uniform_real_distribution<double>& dist)
-        const override
+                     ray& scattered,
+                     sampler& rng)
+        const
         {
             vec3 reflected = reflect(ray_in.get_direction(), record.surface_normal);
-            reflected = unit_vector(reflected) + (fuzz * random_unit_vector_thread_safe(rng, dist));
-            scattered = ray(record.intersection_point, reflected, ray_in.time());
+            reflected = unit_vector(reflected) + (fuzz * rng.random_unit_vector());
+            scattered = record.spawn_ray(reflected, ray_in.time());
             attenuation = albedo;
 
             return (dot(scattered.get_direction(), record.surface_normal) > 0);
@@ -131,55 +64,16 @@ class metal : public material
         private:
             colour albedo;
             double fuzz;
-
-            vec3 random_unit_vector_thread_safe(std::mt19937& rng, std::uniform_real_distribution<double>& dist) const
-            {
-                while (true)
-                {
-                    auto random_point = vec3(dist(rng) * 2.0 - 1.0, dist(rng) * 2.0 - 1.0, dist(rng) * 2.0 - 1.0);
-                    auto squared_length = random_point.get_length_squared();
-                    if (1e-160 < squared_length && squared_length <= 1)
-                    {
-                        return random_point / sqrt(squared_length);
-                    }
-                }
-            }
 };
 
-class dielectric : public material
+class dielectric
 {
     public:
         dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-        bool scatter(const ray& ray_in, const hit_record& record, colour& attenuation, ray& scattered)
-        const override
-        {
-            attenuation = colour(1.0, 1.0, 1.0);
-            double ri = record.front_face ? (1.0 / refraction_index) : refraction_index;
-
-            vec3 unit_direction = unit_vector(ray_in.get_direction());
-            double cos_theta = std::fmin(dot(-unit_direction, record.surface_normal), 1.0);
-            double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
-
-            bool cannot_refract = ri * sin_theta > 1.0;
-            vec3 direction;
-
-            if (cannot_refract || reflectance(cos_theta, ri) > random_double())
-            {
-                direction = reflect(unit_direction, record.surface_normal);
-            }
-            else
-            {
-                direction = refract(unit_direction, record.surface_normal, ri);
-            }
-
-            scattered = ray(record.intersection_point, direction, ray_in.time());
-            return true;
-        }
-
-        bool scatter_thread_safe(const ray& ray_in, const hit_record& record, colour& attenuation, ray& scattered,
-                                 std::mt19937& rng, std::uniform_real_distribution<double>& dist)
-        const override
+        bool scatter(const ray& ray_in, const hit_record& record, colour& attenuation, ray& scattered,
+                     sampler& rng)
+        const
         {
             attenuation = colour(1.0, 1.0, 1.0);
             double ri = record.front_face ? (1.0 / refraction_index) : refraction_index;
@@ -191,7 +85,7 @@ class dielectric : public material
             bool cannot_refract = ri * sin_theta > 1.0;
             vec3 direction;
 
-            if (cannot_refract || reflectance(cos_theta, ri) > dist(rng))
+            if (cannot_refract || reflectance(cos_theta, ri) > rng.random_double())
             {
                 direction = reflect(unit_direction, record.surface_normal);
             }
@@ -200,7 +94,7 @@ class dielectric : public material
                 direction = refract(unit_direction, record.surface_normal, ri);
             }
 
-            scattered = ray(record.intersection_point, direction, ray_in.time());
+            scattered = record.spawn_ray(direction, ray_in.time());
             return true;
         }
         
@@ -218,4 +112,53 @@ class dielectric : public material
         }
 };
 
-#endif
\ No newline at end of file
+// The closed set of materials. Adding a material type means adding it here.
+using material = std::variant<lambertian, metal, dielectric>;
+
+// Scene-owned storage for every material. Primitives and hit records refer to entries by
+// material_id, an index into the table.
+class material_table
+{
+    public:
+        static constexpr int type_count = int(std::variant_size_v<material>);
+
+        template <typename T, typename... Args>
+        material_id add(Args&&... args)
+        {
+            materials.emplace_back(std::in_place_type<T>, std::forward<Args>(args)...);
+            return material_id(materials.size() - 1);
+        }
+
+        size_t size() const
+        {
+            return materials.size();
+        }
+
+        // Which alternative of the variant a material is, in [0, type_count), for grouping rays by
+        // material type
+        int type(material_id id) const
+        {
+            return int(materials[id].index());
+        }
+
+        // The material as its concrete type, for code that has already grouped its work by type()
+        template <typename T>
+        const T& get(material_id id) const
+        {
+            return std::get<T>(materials[id]);
+        }
+
+        bool scatter(material_id id, const ray& ray_in, const hit_record& record, colour& attenuation,
+                     ray& scattered, sampler& rng) const
+        {
+            return std::visit([&](const auto& mat)
+            {
+                return mat.scatter(ray_in, record, attenuation, scattered, rng);
+            }, materials[id]);
+        }
+
+    private:
+        std::vector<material> materials;
+};
+
+#endif
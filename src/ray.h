@@ -10,13 +10,26 @@ class ray {
         // ray(const point3& ray_origin, const vec3& ray_direction)
         //     : origin_point(ray_origin), direction_vector(ray_direction) {}
         ray(const point3& ray_origin, const vec3& ray_direction, double time)
-            : origin_point(ray_origin), direction_vector(ray_direction), tm(time) {}
+            : origin_point(ray_origin), direction_vector(ray_direction), tm(time)
+        {
+            // Every ray is traversed at least once, so pay for the divides here rather than per
+            // box. A zero component gives an infinite reciprocal, which the slab tests handle.
+            for (int axis = 0; axis < 3; axis++)
+            {
+                inverse_direction_vector[axis] = 1.0 / ray_direction[axis];
+                negative[axis] = inverse_direction_vector[axis] < 0;
+            }
+        }
 
         ray(const point3& ray_origin, const vec3& ray_direction)
             : ray(ray_origin, ray_direction, 0) {}
 
         const point3& get_origin() const  { return origin_point; }
         const vec3& get_direction() const { return direction_vector; }
+        const vec3& get_inverse_direction() const { return inverse_direction_vector; }
+
+        // True if the direction points towards -axis, i.e. the box's max plane is entered first
+        bool direction_is_negative(int axis) const { return negative[axis]; }
 
         double time() const
         {
@@ -33,6 +46,8 @@ class ray {
         point3 origin_point;        // Starting point of the ray
         vec3 direction_vector;      // Direction the ray is pointing
         double tm;
+        vec3 inverse_direction_vector;  // Componentwise reciprocal of direction_vector
+        bool negative[3] = {false, false, false};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,336 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Up to 64 rays traced through the BVH together, e.g. the primary rays of an 8x8 pixel block.
+// Neighbouring primary rays visit almost the same nodes, so the packet shares one traversal
+// stack: each node is fetched once for all of them, and each box is slab-tested against every
+// ray in one SIMD loop. Sets of rays are bit masks, bit i standing for ray i.
+//
+// A packet only holds together if all its rays point into the same octant; otherwise (see
+// coherent) its rays are traced one at a time.
+class ray_packet
+{
+    public:
+        static constexpr int capacity = 64;
+
+        int count = 0;
+        ray rays[capacity];
+        double t_max[capacity];             // Closest hit so far, infinity before one is found
+        hit_record records[capacity];
+        uint64_t hit_mask = 0;              // Rays whose record holds a hit
+
+        bool coherent = false;              // All direction signs agree
+        bool direction_is_negative[3];      // Shared by every ray when coherent
+
+        void clear()
+        {
+            count = 0;
+            hit_mask = 0;
+        }
+
+        void add(const ray& ray_obj)
+        {
+            int index = count++;
+            rays[index] = ray_obj;
+            t_max[index] = infinity;
+            records[index] = hit_record();
+        }
+
+        uint64_t all_rays() const
+        {
+            return (count == capacity) ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+        }
+
+        // Call once all rays are added: fills the float lanes for the slab tests and the packet's
+        // bounds for frustum culling, and decides whether the packet is coherent.
+        void prepare()
+        {
+            coherent = count > 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                direction_is_negative[axis] = (count > 0) && rays[0].direction_is_negative(axis);
+                frustum_origin_min[axis] = frustum_inverse_min[axis] = std::numeric_limits<float>::infinity();
+                frustum_origin_max[axis] = frustum_inverse_max[axis] = -std::numeric_limits<float>::infinity();
+            }
+
+            for (int i = 0; i < capacity; i++)
+            {
+                if (i >= count)
+                {
+                    // Padding lanes never hit anything
+                    lane_t_far[i] = -std::numeric_limits<float>::infinity();
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        lane_near_origin[axis][i] = 0;
+                        lane_far_origin[axis][i] = 0;
+                        lane_inverse[axis][i] = 0;
+                    }
+                    continue;
+                }
+
+                lane_t_far[i] = std::numeric_limits<float>::infinity();
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    // The float origin is widened by an ulp either way, as in wide_bvh_ray, so the
+                    // range it spans always holds the double-precision origin
+                    float origin = float(rays[i].get_origin()[axis]);
+                    float ulp = float_rounding_error(origin);
+                    float inverse = float(rays[i].get_inverse_direction()[axis]);
+                    bool negative = rays[i].direction_is_negative(axis);
+                    lane_near_origin[axis][i] = negative ? origin - ulp : origin + ulp;
+                    lane_far_origin[axis][i] = negative ? origin + ulp : origin - ulp;
+                    lane_inverse[axis][i] = inverse;
+
+                    frustum_origin_min[axis] = std::min(frustum_origin_min[axis], origin - ulp);
+                    frustum_origin_max[axis] = std::max(frustum_origin_max[axis], origin + ulp);
+                    frustum_inverse_min[axis] = std::min(frustum_inverse_min[axis], inverse);
+                    frustum_inverse_max[axis] = std::max(frustum_inverse_max[axis], inverse);
+
+                    if (rays[i].direction_is_negative(axis) != direction_is_negative[axis])
+                    {
+                        coherent = false;
+                    }
+                }
+            }
+
+            // A zero direction component gives an infinite reciprocal, and 0 * infinity would
+            // make the frustum bounds meaningless, so such packets skip frustum culling
+            frustum_valid = true;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (!std::isfinite(frustum_inverse_min[axis]) || !std::isfinite(frustum_inverse_max[axis]))
+                {
+                    frustum_valid = false;
+                }
+            }
+        }
+
+        // Record a closer hit for ray i, found while its interval was [0, t_max[i]]
+        void shrink(int i, double t)
+        {
+            t_max[i] = t;
+            lane_t_far[i] = float(t) * aabb::float_far_scale;
+            hit_mask |= uint64_t(1) << i;
+        }
+
+        // Interval-arithmetic frustum test of box_count boxes, with bounds given as structure of
+        // arrays (bounds_min[axis][box]). The slab distances of every ray lie within bounds
+        // computed from the packet's ranges of origins and reciprocal directions, so boxes those
+        // bounds miss are missed by every ray and are culled without testing rays one by one.
+        // Returns a bit mask of the boxes some ray may hit. Only valid for coherent packets.
+        template <int box_count>
+        int frustum_may_hit(const float* const* bounds_min, const float* const* bounds_max) const
+        {
+            if (!frustum_valid)
+            {
+                return (1 << box_count) - 1;
+            }
+
+            const float* near[3];
+            const float* far[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                near[axis] = direction_is_negative[axis] ? bounds_max[axis] : bounds_min[axis];
+                far[axis] = direction_is_negative[axis] ? bounds_min[axis] : bounds_max[axis];
+            }
+
+            int mask = 0;
+            for (int box = 0; box < box_count; box++)
+            {
+                float entry = 0;
+                float exit = std::numeric_limits<float>::infinity();
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    // Lower bound of (near - origin) * inverse and upper bound of (far - origin) *
+                    // inverse, over the packet's ranges of both
+                    float near_a = (near[axis][box] - frustum_origin_max[axis]) * frustum_inverse_min[axis];
+                    float near_b = (near[axis][box] - frustum_origin_max[axis]) * frustum_inverse_max[axis];
+                    float near_c = (near[axis][box] - frustum_origin_min[axis]) * frustum_inverse_min[axis];
+                    float near_d = (near[axis][box] - frustum_origin_min[axis]) * frustum_inverse_max[axis];
+                    float far_a = (far[axis][box] - frustum_origin_max[axis]) * frustum_inverse_min[axis];
+                    float far_b = (far[axis][box] - frustum_origin_max[axis]) * frustum_inverse_max[axis];
+                    float far_c = (far[axis][box] - frustum_origin_min[axis]) * frustum_inverse_min[axis];
+                    float far_d = (far[axis][box] - frustum_origin_min[axis]) * frustum_inverse_max[axis];
+
+                    float near_lower = std::min(std::min(near_a, near_b), std::min(near_c, near_d));
+                    float far_upper = std::max(std::max(far_a, far_b), std::max(far_c, far_d));
+                    entry = (near_lower > entry) ? near_lower : entry;
+                    exit = (far_upper < exit) ? far_upper : exit;
+                }
+
+                // The origin ranges hold every ray's exact origin, so what is left is the relative
+                // error of rounding the reciprocal, the subtraction and the product, which
+                // float_far_scale covers just as in the per-ray test
+                mask |= int(entry <= exit * aabb::float_far_scale) << box;
+            }
+            return mask;
+        }
+
+        // Slab test of one box against the rays in ray_mask, all at once. Returns the rays whose
+        // interval overlaps the box and sets t_near to the smallest entry distance among them.
+        // Only valid for coherent packets: the near plane on each axis is the same for every ray.
+        uint64_t intersect_box(const float* bounds_min, const float* bounds_max, uint64_t ray_mask, float& t_near) const
+        {
+            float near[3];
+            float far[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                near[axis] = direction_is_negative[axis] ? bounds_max[axis] : bounds_min[axis];
+                far[axis] = direction_is_negative[axis] ? bounds_min[axis] : bounds_max[axis];
+            }
+
+            uint64_t result = 0;
+            t_near = std::numeric_limits<float>::infinity();
+            alignas(32) float entries[8];
+
+            for (int base = 0; base < count; base += 8)
+            {
+                unsigned group = unsigned(ray_mask >> base) & 0xFF;
+                if (group == 0)
+                {
+                    continue;
+                }
+
+                unsigned hits = intersect_group(base, near, far, entries) & group;
+                result |= uint64_t(hits) << base;
+
+                for (int lane = 0; hits != 0; lane++, hits >>= 1)
+                {
+                    if ((hits & 1) && entries[lane] < t_near)
+                    {
+                        t_near = entries[lane];
+                    }
+                }
+            }
+            return result;
+        }
+
+        // The rays in ray_mask whose closest hit so far is not nearer than t_near
+        uint64_t rays_reaching(uint64_t ray_mask, float t_near) const
+        {
+            uint64_t result = 0;
+            for (int base = 0; base < count; base += 8)
+            {
+                unsigned group = unsigned(ray_mask >> base) & 0xFF;
+                if (group == 0)
+                {
+                    continue;
+                }
+#if defined(__AVX__)
+                __m256 reaching = _mm256_cmp_ps(_mm256_load_ps(lane_t_far + base), _mm256_set1_ps(t_near), _CMP_GE_OQ);
+                group &= unsigned(_mm256_movemask_ps(reaching));
+#else
+                for (int lane = 0; lane < 8; lane++)
+                {
+                    if (!(lane_t_far[base + lane] >= t_near))
+                    {
+                        group &= ~(1u << lane);
+                    }
+                }
+#endif
+                result |= uint64_t(group) << base;
+            }
+            return result;
+        }
+
+    private:
+        // Structure-of-arrays float copies of the rays for the SIMD slab test, and their ranges for
+        // the frustum test
+        alignas(32) float lane_near_origin[3][capacity];    // Widened towards the near planes
+        alignas(32) float lane_far_origin[3][capacity];     // Widened away from the far planes
+        alignas(32) float lane_inverse[3][capacity];
+        alignas(32) float lane_t_far[capacity];
+
+        bool frustum_valid = false;
+        float frustum_origin_min[3], frustum_origin_max[3];
+        float frustum_inverse_min[3], frustum_inverse_max[3];
+
+        // Slab test of rays [base, base + 8) with interval [0, t_far]. Writes each ray's entry
+        // distance and returns a bit mask of the rays that overlap the box. As in
+        // intersect_children, each exit distance is scaled by float_far_scale and the operand
+        // order makes NaN slabs drop out.
+        unsigned intersect_group(int base, const float* near, const float* far, float* entries) const
+        {
+#if defined(__AVX__)
+            __m256 entry = _mm256_setzero_ps();
+            __m256 exit = _mm256_load_ps(lane_t_far + base);
+            __m256 scale = _mm256_set1_ps(aabb::float_far_scale);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __m256 near_origin = _mm256_load_ps(lane_near_origin[axis] + base);
+                __m256 far_origin = _mm256_load_ps(lane_far_origin[axis] + base);
+                __m256 inverse = _mm256_load_ps(lane_inverse[axis] + base);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near[axis]), near_origin), inverse);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far[axis]), far_origin), inverse);
+                t1 = _mm256_mul_ps(t1, scale);
+                entry = _mm256_max_ps(t0, entry);
+                exit = _mm256_min_ps(t1, exit);
+            }
+
+            _mm256_store_ps(entries, entry);
+            return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+#else
+            unsigned mask = 0;
+            for (int lane = 0; lane < 8; lane++)
+            {
+                int i = base + lane;
+                float entry = 0;
+                float exit = lane_t_far[i];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float t0 = (near[axis] - lane_near_origin[axis][i]) * lane_inverse[axis][i];
+                    float t1 = (far[axis] - lane_far_origin[axis][i]) * lane_inverse[axis][i] * aabb::float_far_scale;
+                    entry = (t0 > entry) ? t0 : entry;
+                    exit = (t1 < exit) ? t1 : exit;
+                }
+                entries[lane] = entry;
+                mask |= unsigned(entry <= exit) << lane;
+            }
+            return mask;
+#endif
+        }
+};
+
+// Trace a packet through a world. Worlds with their own packet traversal (scene) use it; any
+// other hittable traces the rays one at a time.
+template <typename World, typename = void>
+struct has_packet_traversal : std::false_type {};
+
+template <typename World>
+struct has_packet_traversal<World, std::void_t<decltype(std::declval<const World&>().hit_packet(std::declval<ray_packet&>()))>>
+    : std::true_type {};
+
+template <typename World>
+void hit_packet(const World& world, ray_packet& packet)
+{
+    if constexpr (has_packet_traversal<World>::value)
+    {
+        world.hit_packet(packet);
+    }
+    else
+    {
+        for (int i = 0; i < packet.count; i++)
+        {
+            if (world.hit(packet.rays[i], interval(0, infinity), packet.records[i]))
+            {
+                packet.shrink(i, packet.records[i].t);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef RAY_QUEUE_H
+#define RAY_QUEUE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The paths of one wave of the wavefront integrator, stored as a structure of arrays: entry i of
+// every array belongs to path i. Each stage walks the queue front to back touching only the
+// fields it needs, so its loop streams through contiguous memory instead of hopping between
+// whole path objects.
+class ray_queue
+{
+    public:
+        // The ray each path traces next
+        std::vector<double> origin_x, origin_y, origin_z;
+        std::vector<double> direction_x, direction_y, direction_z;
+        std::vector<double> time;
+
+        // Product of the attenuations along the path so far
+        std::vector<double> throughput_r, throughput_g, throughput_b;
+
+        std::vector<sampler> rng;           // The path's own random stream
+        std::vector<uint32_t> slot;         // Where the path's radiance is written when it ends
+
+        // Written by the extend stage for the shade stage
+        std::vector<hit_record> hits;
+        std::vector<uint8_t> has_hit;
+
+        std::vector<uint8_t> alive;         // Cleared by the shade stage when a path ends
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        // Drop every path, keeping room for capacity of them. The arrays only ever grow, so a
+        // queue reused wave after wave stops touching the heap.
+        void reset(size_t capacity)
+        {
+            count = 0;
+            if (capacity > time.size())
+            {
+                for (auto* field : {&origin_x, &origin_y, &origin_z, &direction_x, &direction_y, &direction_z,
+                                    &time, &throughput_r, &throughput_g, &throughput_b})
+                {
+                    field -> resize(capacity);
+                }
+                rng.resize(capacity);
+                slot.resize(capacity);
+                hits.resize(capacity);
+                has_hit.resize(capacity);
+                alive.resize(capacity);
+            }
+        }
+
+        // Append a path with unit throughput. The queue must have room for it.
+        void push(const ray& ray_obj, const sampler& path_rng, uint32_t result_slot)
+        {
+            size_t index = count++;
+            set_ray(index, ray_obj);
+            set_throughput(index, colour(1.0, 1.0, 1.0));
+            rng[index] = path_rng;
+            slot[index] = result_slot;
+            alive[index] = 1;
+        }
+
+        ray get_ray(size_t index) const
+        {
+            return ray(point3(origin_x[index], origin_y[index], origin_z[index]),
+                       vec3(direction_x[index], direction_y[index], direction_z[index]),
+                       time[index]);
+        }
+
+        void set_ray(size_t index, const ray& ray_obj)
+        {
+            const point3& origin = ray_obj.get_origin();
+            const vec3& direction = ray_obj.get_direction();
+            origin_x[index] = origin.get_x();
+            origin_y[index] = origin.get_y();
+            origin_z[index] = origin.get_z();
+            direction_x[index] = direction.get_x();
+            direction_y[index] = direction.get_y();
+            direction_z[index] = direction.get_z();
+            time[index] = ray_obj.time();
+        }
+
+        colour get_throughput(size_t index) const
+        {
+            return colour(throughput_r[index], throughput_g[index], throughput_b[index]);
+        }
+
+        void set_throughput(size_t index, const colour& throughput)
+        {
+            throughput_r[index] = throughput.get_x();
+            throughput_g[index] = throughput.get_y();
+            throughput_b[index] = throughput.get_z();
+        }
+
+        // Move the paths still alive to the front, keeping their order, and drop the rest. The
+        // hit arrays are not carried over: the next extend stage rewrites them.
+        void compact()
+        {
+            size_t kept = 0;
+            for (size_t index = 0; index < count; index++)
+            {
+                if (!alive[index])
+                {
+                    continue;
+                }
+
+                if (kept != index)
+                {
+                    origin_x[kept] = origin_x[index];
+                    origin_y[kept] = origin_y[index];
+                    origin_z[kept] = origin_z[index];
+                    direction_x[kept] = direction_x[index];
+                    direction_y[kept] = direction_y[index];
+                    direction_z[kept] = direction_z[index];
+                    time[kept] = time[index];
+                    throughput_r[kept] = throughput_r[index];
+                    throughput_g[kept] = throughput_g[index];
+                    throughput_b[kept] = throughput_b[index];
+                    rng[kept] = rng[index];
+                    slot[kept] = slot[index];
+                    alive[kept] = 1;
+                }
+                kept++;
+            }
+            count = kept;
+        }
+
+        // Reorder the paths so that rays leaving nearby points in the same direction octant sit
+        // next to each other, and consecutive traversals walk the same BVH nodes. The key is the
+        // octant above a Morton code of the origin, quantised over the bounds of the queue's
+        // own origins. Like compact, the hit arrays are not carried over.
+        void sort_coherent()
+        {
+            if (count < 2)
+            {
+                return;
+            }
+
+            double lower[3], extent[3];
+            const std::vector<double>* origins[3] = {&origin_x, &origin_y, &origin_z};
+            for (int axis = 0; axis < 3; axis++)
+            {
+                auto range = std::minmax_element(origins[axis] -> begin(), origins[axis] -> begin() + count);
+                lower[axis] = *range.first;
+                extent[axis] = *range.second - *range.first;
+            }
+
+            // Sort key in the high half, queue index in the low half
+            sort_keys.resize(count);
+            for (size_t index = 0; index < count; index++)
+            {
+                uint32_t cell[3];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    double position = (extent[axis] > 0) ? ((*origins[axis])[index] - lower[axis]) / extent[axis] : 0;
+                    cell[axis] = std::min(uint32_t(position * morton_cells), morton_cells - 1);
+                }
+
+                uint32_t octant = (direction_x[index] < 0 ? 4u : 0u) | (direction_y[index] < 0 ? 2u : 0u)
+                                | (direction_z[index] < 0 ? 1u : 0u);
+                uint64_t key = (uint64_t(octant) << (3 * morton_bits)) | morton_code(cell[0], cell[1], cell[2]);
+                sort_keys[index] = (key << 32) | index;
+            }
+            radix_sort();
+
+            for (auto* field : {&origin_x, &origin_y, &origin_z, &direction_x, &direction_y, &direction_z,
+                                &time, &throughput_r, &throughput_g, &throughput_b})
+            {
+                gather(*field, sort_doubles);
+            }
+            gather(rng, sort_samplers);
+            gather(slot, sort_slots);
+        }
+
+    private:
+        static constexpr int morton_bits = 9;                   // Per axis
+        static constexpr uint32_t morton_cells = 1u << morton_bits;
+
+        size_t count = 0;
+
+        // Scratch space of sort_coherent, kept so sorting wave after wave stops touching the heap
+        std::vector<uint64_t> sort_keys;
+        std::vector<uint64_t> sort_keys_scratch;
+        std::vector<double> sort_doubles;
+        std::vector<sampler> sort_samplers;
+        std::vector<uint32_t> sort_slots;
+
+        // Least significant digit radix sort of sort_keys by their high half, radix_bits at a
+        // time. Each pass is stable, so the result is ordered by the whole key.
+        void radix_sort()
+        {
+            constexpr int key_bits = 3 * morton_bits + 3;
+            constexpr int radix_bits = 10;
+            constexpr uint32_t radix_size = 1u << radix_bits;
+
+            sort_keys_scratch.resize(count);
+            for (int shift = 32; shift < 32 + key_bits; shift += radix_bits)
+            {
+                size_t offsets[radix_size] = {};
+                for (size_t k = 0; k < count; k++)
+                {
+                    offsets[(sort_keys[k] >> shift) & (radix_size - 1)]++;
+                }
+
+                size_t total = 0;
+                for (uint32_t digit = 0; digit < radix_size; digit++)
+                {
+                    size_t digit_count = offsets[digit];
+                    offsets[digit] = total;
+                    total += digit_count;
+                }
+
+                for (size_t k = 0; k < count; k++)
+                {
+                    sort_keys_scratch[offsets[(sort_keys[k] >> shift) & (radix_size - 1)]++] = sort_keys[k];
+                }
+                sort_keys.swap(sort_keys_scratch);
+            }
+        }
+
+        // Spread the low 10 bits of value out to every third bit
+        static uint32_t spread_bits(uint32_t value)
+        {
+            value &= 0x3ff;
+            value = (value | (value << 16)) & 0x030000ff;
+            value = (value | (value << 8)) & 0x0300f00f;
+            value = (value | (value << 4)) & 0x030c30c3;
+            value = (value | (value << 2)) & 0x09249249;
+            return value;
+        }
+
+        static uint32_t morton_code(uint32_t x, uint32_t y, uint32_t z)
+        {
+            return (spread_bits(x) << 2) | (spread_bits(y) << 1) | spread_bits(z);
+        }
+
+        // Put field into sort_keys order, through scratch, which it then swaps with
+        template <typename T>
+        void gather(std::vector<T>& field, std::vector<T>& scratch) const
+        {
+            scratch.resize(field.size());
+            for (size_t k = 0; k < count; k++)
+            {
+                scratch[k] = field[uint32_t(sort_keys[k])];
+            }
+            field.swap(scratch);
+        }
+};
+
+#endif
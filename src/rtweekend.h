@@ -2,11 +2,11 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <fstream>
-#include <cstdlib>
 
 // C++ Std Usings
 using std::make_shared;
@@ -22,21 +22,17 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
-inline double random_double()
+// Index of the lowest set bit of a non-empty mask, for walking the lanes, children or rays a
+// bit mask stands for
+inline int lowest_bit(uint64_t mask)
 {
-    // Returns a random real in [0,1]
-    return std::rand() / (RAND_MAX + 1.0);
-}
-
-inline double random_double(double min, double max)
-{
-    // Returns a random real in [min,max]
-    return min + (max - min) * random_double();
-}
-
-inline int random_int(int min, int max)
-{
-    return int(random_double(min, max + 1));
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    int bit = 0;
+    while (!(mask & 1)) { mask >>= 1; bit++; }
+    return bit;
+#endif
 }
 
 // Common Headers
@@ -0,0 +1,185 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "ray_packet.h"
+#include "sphere_batch.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+// The closed set of primitive types the renderer knows about. Each type keeps its own storage
+// and its own accelerator (linear_bvh, bvh4 or bvh8), and every call from the scene down to the
+// primitive tests is resolved at compile time, so the compiler sees the whole traversal and
+// intersection loop. Custom shapes still work through the virtual hittable interface by going
+// into a hittable_list part.
+template <template <typename> class accelerator, typename... Primitives>
+class scene final : public hittable
+{
+    public:
+        // Takes over one storage object per primitive type and builds an accelerator over each
+        scene(Primitives... primitive_sets, const bvh_build_options& options = bvh_build_options(),
+              thread_pool* pool = nullptr)
+            : parts(accelerator<Primitives>(std::move(primitive_sets), options, pool)...)
+        {
+            bbox = bounding_box(std::index_sequence_for<Primitives...>());
+        }
+
+        bool intersect(const ray& ray_obj, interval ray_interval, hit_record& record) const override
+        {
+            return intersect(ray_obj, ray_interval, record, std::index_sequence_for<Primitives...>()) >= 0;
+        }
+
+        // Hides hittable::hit: the final surface step is dispatched statically as well
+        bool hit(const ray& ray_obj, interval ray_interval, hit_record& record) const
+        {
+            int part = intersect(ray_obj, ray_interval, record, std::index_sequence_for<Primitives...>());
+            if (part < 0)
+            {
+                return false;
+            }
+
+            surface(ray_obj, record, part, std::index_sequence_for<Primitives...>());
+            return true;
+        }
+
+        // Closest hits of a prepared packet, traced through each part as a packet, with the full
+        // record built for every ray that hit. An incoherent packet is traced ray by ray.
+        void hit_packet(ray_packet& packet) const
+        {
+            if (!packet.coherent)
+            {
+                for (int i = 0; i < packet.count; i++)
+                {
+                    if (intersect(packet.rays[i], interval(0, packet.t_max[i]), packet.records[i]))
+                    {
+                        packet.shrink(i, packet.records[i].t);
+                        surface(packet.rays[i], packet.records[i]);
+                    }
+                }
+                return;
+            }
+
+            int hit_part[ray_packet::capacity];
+            intersect_packet(packet, hit_part, std::index_sequence_for<Primitives...>());
+
+            for (int i = 0; i < packet.count; i++)
+            {
+                if ((packet.hit_mask >> i) & 1)
+                {
+                    surface(packet.rays[i], packet.records[i], hit_part[i], std::index_sequence_for<Primitives...>());
+                }
+            }
+        }
+
+        void surface(const ray& ray_obj, hit_record& record) const override
+        {
+            record.object -> surface(ray_obj, record);
+        }
+
+        aabb bounding_box() const override
+        {
+            return bbox;
+        }
+
+        size_t node_count() const
+        {
+            return node_count(std::index_sequence_for<Primitives...>());
+        }
+
+        // Expected cost of tracing a ray through every part, under the surface area heuristic.
+        // Each part's own cost is weighted by the chance that a ray hitting the scene's box also
+        // hits the part's.
+        double sah_cost() const
+        {
+            return sah_cost(std::index_sequence_for<Primitives...>());
+        }
+
+    private:
+        std::tuple<accelerator<Primitives>...> parts;
+        aabb bbox;
+
+        // Closest hit over all parts; returns the index of the part that holds it, or -1
+        template <size_t... I>
+        int intersect(const ray& ray_obj, interval ray_interval, hit_record& record, std::index_sequence<I...>) const
+        {
+            int hit_part = -1;
+            auto intersect_part = [&](const auto& part, int index)
+            {
+                if (part.intersect(ray_obj, ray_interval, record))
+                {
+                    hit_part = index;
+                    ray_interval.max = record.t;
+                }
+            };
+
+            (intersect_part(std::get<I>(parts), int(I)), ...);
+            return hit_part;
+        }
+
+        // Packet version: hit_part[i] becomes the part holding ray i's closest hit
+        template <size_t... I>
+        void intersect_packet(ray_packet& packet, int* hit_part, std::index_sequence<I...>) const
+        {
+            auto intersect_part = [&](const auto& part, int index)
+            {
+                uint64_t improved = part.intersect_packet(packet);
+                for (int i = 0; i < packet.count; i++)
+                {
+                    if ((improved >> i) & 1)
+                    {
+                        hit_part[i] = index;
+                    }
+                }
+            };
+
+            (intersect_part(std::get<I>(parts), int(I)), ...);
+        }
+
+        template <size_t... I>
+        void surface(const ray& ray_obj, hit_record& record, int part, std::index_sequence<I...>) const
+        {
+            ((part == int(I) ? std::get<I>(parts).leaf_primitives().finish_hit(ray_obj, record) : void()), ...);
+        }
+
+        template <size_t... I>
+        aabb bounding_box(std::index_sequence<I...>) const
+        {
+            aabb box;
+            ((box = aabb(box, std::get<I>(parts).bounding_box())), ...);
+            return box;
+        }
+
+        template <size_t... I>
+        size_t node_count(std::index_sequence<I...>) const
+        {
+            return (size_t(0) + ... + std::get<I>(parts).node_count());
+        }
+
+        template <size_t... I>
+        double sah_cost(std::index_sequence<I...>) const
+        {
+            double scene_area = bbox.surface_area();
+            if (scene_area <= 0)
+            {
+                return 0;
+            }
+
+            // An empty part has cost 0 and an empty box, whose area is not a number
+            auto part_cost = [&](const auto& part)
+            {
+                double cost = part.sah_cost();
+                return (cost > 0) ? cost * part.bounding_box().surface_area() / scene_area : 0.0;
+            };
+            return (0.0 + ... + part_cost(std::get<I>(parts)));
+        }
+};
+
+#endif
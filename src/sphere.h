@@ -4,11 +4,45 @@
 #include "rtweekend.h"
 #include "hittable.h"
 
+#include <limits>
+
+// Fill in the surface of a sphere hit at record.t. The point is projected back onto the sphere
+// in double precision, and record.offset is set so that an intersection test run in Scalar from
+// a ray spawned there cannot find the sphere again at a tiny t.
+//
+// The test decides which side of the surface the origin is on by the sign of
+// c = |center - origin|^2 - radius^2, which is about 2 * radius * offset there. With u the unit
+// roundoff of Scalar, rounding the origin and center to Scalar and subtracting them moves each
+// component of center - origin by at most u * (|center| + |origin| + |center - origin|), plus
+// one more u * |center| for the time step of a moving center. The sums of squares add under
+// 4 * u * radius^2 more. So c keeps its sign once offset exceeds
+// u * (2 * |center|_1 + |origin|_1 + (2 + sqrt 3) * radius), which epsilon = 2 * u times
+// (|center|_1 + |point|_1 + 2 * radius) covers.
+template <typename Scalar>
+inline void set_sphere_surface(const ray& ray_obj, const point3& center, double radius, material_id mat,
+                               hit_record& record)
+{
+    constexpr double epsilon = std::numeric_limits<Scalar>::epsilon();
+
+    vec3 from_center = ray_obj.get_point_at(record.t) - center;
+    vec3 outward_normal = from_center / from_center.get_length();
+    record.intersection_point = center + radius * outward_normal;
+    record.set_face_normal(ray_obj, outward_normal);
+    record.mat = mat;
+
+    double magnitude = 2 * radius;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        magnitude += std::fabs(center[axis]) + std::fabs(record.intersection_point[axis]);
+    }
+    record.offset = epsilon * magnitude;
+}
+
 class sphere : public hittable
 {
     public:
         // Stationary Sphere
-        sphere(const point3& static_sphere_center, double sphere_radius, shared_ptr<material> mat)
+        sphere(const point3& static_sphere_center, double sphere_radius, material_id mat)
                 : center(static_sphere_center, vec3(0, 0, 0)), radius(std::fmax(0, sphere_radius)), mat(mat)
                 {
                     auto ray_vector = vec3(sphere_radius, sphere_radius, sphere_radius);
@@ -16,7 +50,7 @@ class sphere : public hittable
                 }
 
         // Moving Sphere
-        sphere(const point3& sphere_center1, const point3& sphere_center2, double sphere_radius, shared_ptr<material> mat)
+        sphere(const point3& sphere_center1, const point3& sphere_center2, double sphere_radius, material_id mat)
                 : center(sphere_center1, sphere_center2 - sphere_center1), radius(std::fmax(0, sphere_radius)), mat(mat)
                 {
                     auto ray_vector = vec3(sphere_radius, sphere_radius, sphere_radius);
@@ -25,9 +59,9 @@ class sphere : public hittable
                     bbox = aabb(box1, box2);
                 }
 
-        bool hit(const ray& ray_obj,
-                 interval ray_interval,
-                 hit_record& record) const override
+        bool intersect(const ray& ray_obj,
+                       interval ray_interval,
+                       hit_record& record) const override
         {
             point3 current_center = center.get_point_at(ray_obj.time());
             vec3 origin_to_center = current_center - ray_obj.get_origin();
@@ -56,14 +90,17 @@ class sphere : public hittable
             }
 
             record.t = root;
-            record.intersection_point = ray_obj.get_point_at(record.t);
-            vec3 outward_normal = (record.intersection_point - current_center) / radius;
-            record.set_face_normal(ray_obj, outward_normal);
-            record.mat = mat;
+            record.object = this;
+            record.primitive = 0;
 
             return true;
         }
 
+        void surface(const ray& ray_obj, hit_record& record) const override
+        {
+            set_sphere_surface<double>(ray_obj, center.get_point_at(ray_obj.time()), radius, mat, record);
+        }
+
         aabb bounding_box() const override
         {
             return bbox;
@@ -72,7 +109,7 @@ class sphere : public hittable
     private:
         ray center;
         double radius;
-        shared_ptr<material> mat;
+        material_id mat;
         aabb bbox;
 };
 
@@ -0,0 +1,410 @@
+#ifndef SPHERE_BATCH_H
+#define SPHERE_BATCH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Doubles intersected per step by a sphere batch: 4, 8 or 16. With AVX each group of 4 lanes is
+// one register of doubles; otherwise the lanes run as a scalar loop. Float batches fit twice as
+// many lanes in the same registers.
+#ifndef RT_SPHERE_BATCH_WIDTH
+#define RT_SPHERE_BATCH_WIDTH 4
+#endif
+
+// Many spheres stored as structure-of-arrays: centers, motion vectors, radii and materials each
+// live in their own contiguous array, so a run of spheres can be intersected one SIMD step at a
+// time. A BVH built over the batch reorders it into leaf order, after which every leaf is just a
+// range of the arrays.
+//
+// Scalar is the precision of the stored geometry and of the intersection test. The surface of
+// the final hit is always rebuilt in double precision, with an offset sized for Scalar's error.
+template <typename Scalar>
+class basic_sphere_batch final : public hittable
+{
+    static_assert(std::is_same_v<Scalar, float> || std::is_same_v<Scalar, double>, "Scalar must be float or double");
+
+    public:
+        static constexpr int lane_width = RT_SPHERE_BATCH_WIDTH * int(sizeof(double) / sizeof(Scalar));
+        static_assert(RT_SPHERE_BATCH_WIDTH == 4 || RT_SPHERE_BATCH_WIDTH == 8 || RT_SPHERE_BATCH_WIDTH == 16,
+                      "lane width must be 4, 8 or 16");
+
+        basic_sphere_batch() = default;
+
+        // Copy the spheres of a batch of another precision
+        template <typename Other>
+        explicit basic_sphere_batch(const basic_sphere_batch<Other>& other)
+        {
+            for (size_t i = 0; i < other.size(); i++)
+            {
+                add(other.center_at(i, 0), other.center_at(i, 1), other.radius(i), other.material(i));
+            }
+        }
+
+        // Stationary Sphere
+        void add(const point3& static_sphere_center, double sphere_radius, material_id mat)
+        {
+            add(static_sphere_center, static_sphere_center, sphere_radius, mat);
+        }
+
+        // Moving Sphere
+        void add(const point3& sphere_center1, const point3& sphere_center2, double sphere_radius, material_id mat)
+        {
+            vec3 motion = sphere_center2 - sphere_center1;
+
+            size_t index = count++;
+            pad();
+
+            center_x[index] = Scalar(sphere_center1[0]);
+            center_y[index] = Scalar(sphere_center1[1]);
+            center_z[index] = Scalar(sphere_center1[2]);
+            motion_x[index] = Scalar(motion[0]);
+            motion_y[index] = Scalar(motion[1]);
+            motion_z[index] = Scalar(motion[2]);
+            radii[index] = Scalar(std::fmax(0, sphere_radius));
+            materials[index] = mat;
+
+            bbox = aabb(bbox, bounding_box(index));
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        // Center of sphere index at the given time, from the stored values
+        point3 center_at(size_t index, double time) const
+        {
+            return point3(center_x[index] + time * motion_x[index],
+                          center_y[index] + time * motion_y[index],
+                          center_z[index] + time * motion_z[index]);
+        }
+
+        double radius(size_t index) const
+        {
+            return radii[index];
+        }
+
+        material_id material(size_t index) const
+        {
+            return materials[index];
+        }
+
+        aabb bounding_box(size_t index) const
+        {
+            auto ray_vector = vec3(radii[index], radii[index], radii[index]);
+            point3 center1 = center_at(index, 0);
+            point3 center2 = center_at(index, 1);
+            return aabb(aabb(center1 - ray_vector, center1 + ray_vector),
+                        aabb(center2 - ray_vector, center2 + ray_vector));
+        }
+
+        aabb bounding_box() const override
+        {
+            return bbox;
+        }
+
+        // Permute the spheres so that the one at order[i] moves to index i
+        void reorder(const std::vector<size_t>& order)
+        {
+            permute(center_x, order);
+            permute(center_y, order);
+            permute(center_z, order);
+            permute(motion_x, order);
+            permute(motion_y, order);
+            permute(motion_z, order);
+            permute(radii, order);
+            permute(materials, order);
+            pad();
+        }
+
+        bool intersect(const ray& ray_obj, interval ray_interval, hit_record& record) const override
+        {
+            return hit_range(ray_obj, ray_interval, 0, count, record);
+        }
+
+        void surface(const ray& ray_obj, hit_record& record) const override
+        {
+            size_t index = record.primitive;
+            set_sphere_surface<Scalar>(ray_obj, center_at(index, ray_obj.time()), radii[index], materials[index], record);
+        }
+
+        // Complete a record from hit_range. The class is final, so this is a direct call.
+        void finish_hit(const ray& ray_obj, hit_record& record) const
+        {
+            surface(ray_obj, record);
+        }
+
+        // Intersect spheres [first, first + range_count) lane_width at a time and keep the
+        // closest hit. On a hit, ray_interval.max shrinks to it and the record gets its t and
+        // sphere index.
+        bool hit_range(const ray& ray_obj, interval& ray_interval, size_t first, size_t range_count,
+                       hit_record& record) const
+        {
+            lane_ray lanes(ray_obj, ray_interval.min);
+
+            Scalar closest = Scalar(ray_interval.max);
+            size_t closest_index = count;
+            size_t end = first + range_count;
+
+            for (size_t block = first; block < end; block += lane_width)
+            {
+                alignas(64) Scalar lane_t[lane_width];
+                uint32_t mask = intersect_block(block, lanes, closest, lane_t);
+
+                // Drop padding lanes past the end of the range
+                size_t active = end - block;
+                if (active < size_t(lane_width))
+                {
+                    mask &= (uint32_t(1) << active) - 1;
+                }
+
+                while (mask != 0)
+                {
+                    int lane = lowest_bit(mask);
+                    mask &= mask - 1;
+                    if (lane_t[lane] < closest)
+                    {
+                        closest = lane_t[lane];
+                        closest_index = block + lane;
+                    }
+                }
+            }
+
+            if (closest_index == count)
+            {
+                return false;
+            }
+
+            ray_interval.max = closest;
+            record.t = closest;
+            record.object = this;
+            record.primitive = closest_index;
+            return true;
+        }
+
+    private:
+        std::vector<Scalar> center_x, center_y, center_z;   // Center at time 0
+        std::vector<Scalar> motion_x, motion_y, motion_z;   // Center displacement from time 0 to 1
+        std::vector<Scalar> radii;
+        std::vector<material_id> materials;
+        size_t count = 0;
+        aabb bbox;
+
+        // The ray terms shared by every lane
+        struct lane_ray
+        {
+            Scalar origin[3];
+            Scalar direction[3];
+            Scalar time;
+            Scalar direction_length_squared;
+            Scalar t_min;
+
+            lane_ray(const ray& r, double interval_min)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    origin[axis] = Scalar(r.get_origin()[axis]);
+                    direction[axis] = Scalar(r.get_direction()[axis]);
+                }
+                time = Scalar(r.time());
+                direction_length_squared = direction[0] * direction[0]
+                                         + direction[1] * direction[1]
+                                         + direction[2] * direction[2];
+                t_min = Scalar(interval_min);
+            }
+        };
+
+        // Intersect lanes [block, block + lane_width), writing each lane's nearest root inside
+        // (t_min, closest) to lane_t. Returns a bit mask of the lanes that have one.
+        uint32_t intersect_block(size_t block, const lane_ray& r, Scalar closest, Scalar* lane_t) const
+        {
+#if defined(__AVX__)
+            if constexpr (std::is_same_v<Scalar, double>)
+            {
+                return intersect_block_avx(block, r, closest, lane_t);
+            }
+            else
+            {
+                return intersect_block_avx_f32(block, r, closest, lane_t);
+            }
+#else
+            uint32_t mask = 0;
+            for (int lane = 0; lane < lane_width; lane++)
+            {
+                size_t i = block + lane;
+                Scalar to_center_x = center_x[i] + r.time * motion_x[i] - r.origin[0];
+                Scalar to_center_y = center_y[i] + r.time * motion_y[i] - r.origin[1];
+                Scalar to_center_z = center_z[i] + r.time * motion_z[i] - r.origin[2];
+
+                Scalar half_b = r.direction[0] * to_center_x
+                              + r.direction[1] * to_center_y
+                              + r.direction[2] * to_center_z;
+                Scalar c = to_center_x * to_center_x
+                         + to_center_y * to_center_y
+                         + to_center_z * to_center_z
+                         - radii[i] * radii[i];
+                Scalar discriminant = half_b * half_b - r.direction_length_squared * c;
+
+                Scalar sqrt_discriminant = std::sqrt(discriminant > 0 ? discriminant : Scalar(0));
+                Scalar near_root = (half_b - sqrt_discriminant) / r.direction_length_squared;
+                Scalar far_root = (half_b + sqrt_discriminant) / r.direction_length_squared;
+
+                // Nearest root strictly inside the interval, as in sphere::intersect
+                bool near_ok = r.t_min < near_root && near_root < closest;
+                bool far_ok = r.t_min < far_root && far_root < closest;
+                lane_t[lane] = near_ok ? near_root : far_root;
+                mask |= uint32_t(discriminant >= 0 && (near_ok || far_ok)) << lane;
+            }
+            return mask;
+#endif
+        }
+
+#if defined(__AVX__)
+        uint32_t intersect_block_avx(size_t block, const lane_ray& r, double closest, double* lane_t) const
+        {
+            const __m256d origin_x = _mm256_set1_pd(r.origin[0]);
+            const __m256d origin_y = _mm256_set1_pd(r.origin[1]);
+            const __m256d origin_z = _mm256_set1_pd(r.origin[2]);
+            const __m256d direction_x = _mm256_set1_pd(r.direction[0]);
+            const __m256d direction_y = _mm256_set1_pd(r.direction[1]);
+            const __m256d direction_z = _mm256_set1_pd(r.direction[2]);
+            const __m256d time = _mm256_set1_pd(r.time);
+            const __m256d a = _mm256_set1_pd(r.direction_length_squared);
+            const __m256d t_min = _mm256_set1_pd(r.t_min);
+            const __m256d t_max = _mm256_set1_pd(closest);
+            const __m256d zero = _mm256_setzero_pd();
+
+            uint32_t mask = 0;
+            for (int step = 0; step < lane_width; step += 4)
+            {
+                size_t i = block + step;
+                __m256d to_center_x = _mm256_sub_pd(_mm256_add_pd(_mm256_loadu_pd(&center_x[i]),
+                                                    _mm256_mul_pd(time, _mm256_loadu_pd(&motion_x[i]))), origin_x);
+                __m256d to_center_y = _mm256_sub_pd(_mm256_add_pd(_mm256_loadu_pd(&center_y[i]),
+                                                    _mm256_mul_pd(time, _mm256_loadu_pd(&motion_y[i]))), origin_y);
+                __m256d to_center_z = _mm256_sub_pd(_mm256_add_pd(_mm256_loadu_pd(&center_z[i]),
+                                                    _mm256_mul_pd(time, _mm256_loadu_pd(&motion_z[i]))), origin_z);
+                __m256d radius = _mm256_loadu_pd(&radii[i]);
+
+                __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(direction_x, to_center_x),
+                                                             _mm256_mul_pd(direction_y, to_center_y)),
+                                               _mm256_mul_pd(direction_z, to_center_z));
+                __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(to_center_x, to_center_x),
+                                                                      _mm256_mul_pd(to_center_y, to_center_y)),
+                                                        _mm256_mul_pd(to_center_z, to_center_z)),
+                                          _mm256_mul_pd(radius, radius));
+                __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+
+                __m256d sqrt_discriminant = _mm256_sqrt_pd(_mm256_max_pd(discriminant, zero));
+                __m256d near_root = _mm256_div_pd(_mm256_sub_pd(half_b, sqrt_discriminant), a);
+                __m256d far_root = _mm256_div_pd(_mm256_add_pd(half_b, sqrt_discriminant), a);
+
+                __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(t_min, near_root, _CMP_LT_OQ),
+                                                _mm256_cmp_pd(near_root, t_max, _CMP_LT_OQ));
+                __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(t_min, far_root, _CMP_LT_OQ),
+                                               _mm256_cmp_pd(far_root, t_max, _CMP_LT_OQ));
+                __m256d valid = _mm256_and_pd(_mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ),
+                                              _mm256_or_pd(near_ok, far_ok));
+
+                _mm256_store_pd(lane_t + step, _mm256_blendv_pd(far_root, near_root, near_ok));
+                mask |= uint32_t(_mm256_movemask_pd(valid)) << step;
+            }
+            return mask;
+        }
+
+        // Same test as intersect_block_avx, 8 float lanes per register
+        uint32_t intersect_block_avx_f32(size_t block, const lane_ray& r, float closest, float* lane_t) const
+        {
+            const __m256 origin_x = _mm256_set1_ps(r.origin[0]);
+            const __m256 origin_y = _mm256_set1_ps(r.origin[1]);
+            const __m256 origin_z = _mm256_set1_ps(r.origin[2]);
+            const __m256 direction_x = _mm256_set1_ps(r.direction[0]);
+            const __m256 direction_y = _mm256_set1_ps(r.direction[1]);
+            const __m256 direction_z = _mm256_set1_ps(r.direction[2]);
+            const __m256 time = _mm256_set1_ps(r.time);
+            const __m256 a = _mm256_set1_ps(r.direction_length_squared);
+            const __m256 t_min = _mm256_set1_ps(r.t_min);
+            const __m256 t_max = _mm256_set1_ps(closest);
+            const __m256 zero = _mm256_setzero_ps();
+
+            uint32_t mask = 0;
+            for (int step = 0; step < lane_width; step += 8)
+            {
+                size_t i = block + step;
+                __m256 to_center_x = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&center_x[i]),
+                                                   _mm256_mul_ps(time, _mm256_loadu_ps(&motion_x[i]))), origin_x);
+                __m256 to_center_y = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&center_y[i]),
+                                                   _mm256_mul_ps(time, _mm256_loadu_ps(&motion_y[i]))), origin_y);
+                __m256 to_center_z = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&center_z[i]),
+                                                   _mm256_mul_ps(time, _mm256_loadu_ps(&motion_z[i]))), origin_z);
+                __m256 radius = _mm256_loadu_ps(&radii[i]);
+
+                __m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction_x, to_center_x),
+                                                            _mm256_mul_ps(direction_y, to_center_y)),
+                                              _mm256_mul_ps(direction_z, to_center_z));
+                __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(to_center_x, to_center_x),
+                                                                     _mm256_mul_ps(to_center_y, to_center_y)),
+                                                       _mm256_mul_ps(to_center_z, to_center_z)),
+                                         _mm256_mul_ps(radius, radius));
+                __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(a, c));
+
+                __m256 sqrt_discriminant = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+                __m256 near_root = _mm256_div_ps(_mm256_sub_ps(half_b, sqrt_discriminant), a);
+                __m256 far_root = _mm256_div_ps(_mm256_add_ps(half_b, sqrt_discriminant), a);
+
+                __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(t_min, near_root, _CMP_LT_OQ),
+                                               _mm256_cmp_ps(near_root, t_max, _CMP_LT_OQ));
+                __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(t_min, far_root, _CMP_LT_OQ),
+                                              _mm256_cmp_ps(far_root, t_max, _CMP_LT_OQ));
+                __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+                                             _mm256_or_ps(near_ok, far_ok));
+
+                _mm256_store_ps(lane_t + step, _mm256_blendv_ps(far_root, near_root, near_ok));
+                mask |= uint32_t(_mm256_movemask_ps(valid)) << step;
+            }
+            return mask;
+        }
+#endif
+
+        // Keep lane_width readable entries past the last sphere so a partial block can load a
+        // full SIMD step without bounds checks. Padding lanes are masked out of the result.
+        void pad()
+        {
+            size_t padded = count + lane_width;
+            center_x.resize(padded);
+            center_y.resize(padded);
+            center_z.resize(padded);
+            motion_x.resize(padded);
+            motion_y.resize(padded);
+            motion_z.resize(padded);
+            radii.resize(padded);
+            materials.resize(padded);
+        }
+
+        template <typename T>
+        void permute(std::vector<T>& values, const std::vector<size_t>& order)
+        {
+            std::vector<T> permuted(order.size());
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                permuted[i] = values[order[i]];
+            }
+            values = std::move(permuted);
+        }
+};
+
+using sphere_batch = basic_sphere_batch<double>;
+using sphere_batch_f32 = basic_sphere_batch<float>;
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each owning a deque of tasks. A worker pops work from the back
+// of its own deque and, once that is empty, steals from the front of the other workers' deques,
+// so no core sits idle while any other still has queued work.
+class thread_pool
+{
+    public:
+        using task = std::function<void()>;
+
+        explicit thread_pool(unsigned int num_threads = 0)
+        {
+            if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+            if (num_threads == 0) num_threads = 1; // Fallback if hardware_concurrency fails
+
+            for (unsigned int i = 0; i < num_threads; i++)
+            {
+                queues.push_back(std::make_unique<worker_queue>());
+            }
+
+            for (unsigned int i = 0; i < num_threads; i++)
+            {
+                workers.emplace_back([this, i]() { worker_loop(int(i)); });
+            }
+        }
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        unsigned int size() const
+        {
+            return unsigned(workers.size());
+        }
+
+        // Queue a task. Called from one of this pool's workers, the task goes onto that worker's
+        // own deque; from any other thread, tasks are dealt round-robin across the workers.
+        void submit(task work)
+        {
+            int index = current_worker_index();
+            if (index < 0)
+            {
+                index = int(next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+            }
+
+            pending.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(queues[index] -> mutex);
+                queues[index] -> tasks.push_back(std::move(work));
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                queued++;
+            }
+            wake.notify_one();
+        }
+
+        // Block until every submitted task has finished.
+        void wait_idle()
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            idle.wait(lock, [this]() { return pending.load() == 0; });
+        }
+
+        // Run one queued task on the calling thread, if there is one. Workers prefer their own
+        // deque; any other thread steals. Used to keep a waiting thread busy.
+        bool run_pending_task()
+        {
+            task work;
+            if (!try_pop(current_worker_index(), work))
+            {
+                return false;
+            }
+
+            execute(work);
+            return true;
+        }
+
+        // Index of the calling thread within this pool, or -1 if it is not one of its workers.
+        int current_worker_index() const
+        {
+            return (current_pool() == this) ? current_index() : -1;
+        }
+
+    private:
+        struct worker_queue
+        {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        std::vector<std::thread> workers;
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::atomic<size_t> queued{0};   // Tasks sitting in a deque
+        std::atomic<size_t> pending{0};  // Tasks submitted but not yet finished
+        std::atomic<size_t> next_queue{0};
+        bool stopping = false;
+
+        static const thread_pool*& current_pool()
+        {
+            static thread_local const thread_pool* pool = nullptr;
+            return pool;
+        }
+
+        static int& current_index()
+        {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        bool try_pop(int index, task& work)
+        {
+            // Newest local work first: it is the most likely to still be in cache.
+            if (index >= 0)
+            {
+                auto& own = *queues[index];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty())
+                {
+                    work = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+
+            // Steal the oldest work of the other workers, starting at our neighbour so thieves
+            // spread out instead of all hitting worker 0.
+            size_t count = queues.size();
+            size_t first_victim = (index >= 0) ? size_t(index) + 1 : 0;
+            for (size_t offset = 0; offset < count - (index >= 0 ? 1 : 0); offset++)
+            {
+                auto& victim = *queues[(first_victim + offset) % count];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                    work = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void execute(task& work)
+        {
+            queued.fetch_sub(1);
+            work();
+
+            if (pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                idle.notify_all();
+            }
+        }
+
+        void worker_loop(int index)
+        {
+            current_pool() = this;
+            current_index() = index;
+
+            while (true)
+            {
+                task work;
+                if (try_pop(index, work))
+                {
+                    execute(work);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+                if (stopping && queued.load() == 0)
+                {
+                    return;
+                }
+            }
+        }
+};
+
+// A set of tasks forked onto a pool and joined together. While waiting, the caller keeps running
+// queued tasks instead of blocking, so tasks may themselves fork and wait (nested fork-join, as
+// in a recursive build) without starving the pool.
+class task_group
+{
+    public:
+        explicit task_group(thread_pool& pool) : pool(pool) {}
+
+        ~task_group()
+        {
+            wait();
+        }
+
+        void run(std::function<void()> work)
+        {
+            outstanding.fetch_add(1);
+            pool.submit([this, work = std::move(work)]()
+            {
+                work();
+                outstanding.fetch_sub(1);
+            });
+        }
+
+        void wait()
+        {
+            while (outstanding.load() > 0)
+            {
+                if (!pool.run_pending_task())
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        thread_pool& pool;
+        std::atomic<size_t> outstanding{0};
+};
+
+// Call body(i) for every i in [0, count) on the pool and wait for all of them.
+template <typename Body>
+void parallel_for(thread_pool& pool, size_t count, const Body& body)
+{
+    task_group group(pool);
+    for (size_t i = 0; i < count; i++)
+    {
+        group.run([&body, i]() { body(i); });
+    }
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef TONE_MAP_H
+#define TONE_MAP_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+enum class tone_mapper
+{
+    clamp,          // Clip at 1
+    reinhard,       // x / (1 + x) per channel
+    aces            // Narkowicz's fit of the ACES filmic curve
+};
+
+enum class transfer_function
+{
+    gamma_2,        // sqrt of the tone-mapped value
+    srgb            // The piecewise sRGB curve
+};
+
+struct display_options
+{
+    tone_mapper mapper = tone_mapper::clamp;
+    transfer_function transfer = transfer_function::gamma_2;
+    double exposure = 1.0;          // Scale applied to the radiance before tone mapping
+    bool dither = false;            // 8x8 ordered dither before quantisation
+};
+
+// Turns rows of linear radiance into integer display levels: exposure, tone mapping, transfer
+// function, optional ordered dither, then quantisation to [0, max_value]. With AVX, four samples
+// go through each step at once; the sRGB curve, which would otherwise cost a pow per sample,
+// comes from a table over the square root of the value, interpolated linearly.
+//
+// The defaults (clamp, gamma 2, no dither, exposure 1) map a value v to
+// min(floor((max_value + 1) * sqrt(clamp(v, 0, 1))), max_value).
+class display_transform
+{
+    public:
+        explicit display_transform(const display_options& display = display_options(), int max_value = 255)
+            : options(display), max_value(max_value)
+        {
+            if (options.transfer == transfer_function::srgb)
+            {
+                srgb_table.resize(srgb_table_size + 1);
+                for (int i = 0; i <= srgb_table_size; i++)
+                {
+                    double root = double(i) / srgb_table_size;
+                    srgb_table[i] = srgb_encode(root * root);
+                }
+            }
+
+            // Offsets in (-0.5, 0.5) with a mean of 0, from the 8x8 Bayer matrix
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                {
+                    int rank = 0;
+                    for (int bit = 0; bit < 3; bit++)
+                    {
+                        int x_bit = (x >> bit) & 1;
+                        int y_bit = (y >> bit) & 1;
+                        rank |= ((x_bit ^ y_bit) << (5 - 2 * bit)) | (y_bit << (4 - 2 * bit));
+                    }
+                    bayer[y][x] = options.dither ? (rank + 0.5) / 64 - 0.5 : 0.0;
+                }
+            }
+        }
+
+        // Convert pixel_count RGB pixels starting at image column x0 of row y, writing three
+        // levels per pixel
+        template <typename T>
+        void apply_row(const T* samples, int pixel_count, int x0, int y, uint16_t* levels) const
+        {
+            // Dither offset of every sample over two 8-pixel periods, so four consecutive samples
+            // can be read from any phase without wrapping
+            double dither_row[48];
+            for (int i = 0; i < 48; i++)
+            {
+                dither_row[i] = bayer[y & 7][(i / 3) & 7];
+            }
+
+            size_t sample_count = size_t(pixel_count) * 3;
+            size_t phase = (size_t(x0) * 3) % 24;
+            size_t i = 0;
+
+#if defined(__AVX__)
+            const __m256d zero = _mm256_setzero_pd();
+            const __m256d one = _mm256_set1_pd(1.0);
+            const __m256d exposure = _mm256_set1_pd(options.exposure);
+            const __m256d scale = _mm256_set1_pd(max_value + 1.0);
+            const __m128i top = _mm_set1_epi32(max_value);
+
+            for (; i + 4 <= sample_count; i += 4)
+            {
+                // max with the value first turns NaN into 0
+                __m256d value = _mm256_max_pd(_mm256_mul_pd(load4(samples + i), exposure), zero);
+
+                if (options.mapper == tone_mapper::reinhard)
+                {
+                    value = _mm256_div_pd(value, _mm256_add_pd(one, value));
+                }
+                else if (options.mapper == tone_mapper::aces)
+                {
+                    __m256d numerator = _mm256_mul_pd(value, _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(2.51), value),
+                                                                           _mm256_set1_pd(0.03)));
+                    __m256d denominator = _mm256_add_pd(_mm256_mul_pd(value, _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(2.43), value),
+                                                                                           _mm256_set1_pd(0.59))),
+                                                        _mm256_set1_pd(0.14));
+                    value = _mm256_div_pd(numerator, denominator);
+                }
+
+                __m256d encoded = _mm256_sqrt_pd(_mm256_min_pd(value, one));
+                size_t dither_index = (phase + i) % 24;
+
+                if (options.transfer == transfer_function::srgb)
+                {
+                    alignas(32) double roots[4];
+                    _mm256_store_pd(roots, encoded);
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        levels[i + lane] = quantize(srgb_lookup(roots[lane]), dither_row[dither_index + lane]);
+                    }
+                    continue;
+                }
+
+                __m256d scaled = _mm256_add_pd(_mm256_mul_pd(encoded, scale), _mm256_loadu_pd(dither_row + dither_index));
+                __m128i level = _mm256_cvttpd_epi32(_mm256_max_pd(scaled, zero));
+                level = _mm_min_epi32(level, top);
+
+                alignas(16) int32_t lanes[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes), level);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    levels[i + lane] = uint16_t(lanes[lane]);
+                }
+            }
+#endif
+
+            for (; i < sample_count; i++)
+            {
+                levels[i] = apply(double(samples[i]), dither_row[(phase + i) % 24]);
+            }
+        }
+
+    private:
+        static constexpr int srgb_table_size = 4096;
+
+        display_options options;
+        int max_value;
+        std::vector<double> srgb_table;     // sRGB encoding of root * root for evenly spaced roots
+        double bayer[8][8];
+
+        static double srgb_encode(double linear)
+        {
+            return (linear <= 0.0031308) ? 12.92 * linear : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+        }
+
+        double srgb_lookup(double root) const
+        {
+            double position = root * srgb_table_size;
+            int index = int(position);
+            if (index >= srgb_table_size)
+            {
+                return srgb_table[srgb_table_size];
+            }
+            double fraction = position - index;
+            return srgb_table[index] + fraction * (srgb_table[index + 1] - srgb_table[index]);
+        }
+
+        uint16_t quantize(double encoded, double dither) const
+        {
+            double scaled = encoded * (max_value + 1.0) + dither;
+            int level = (scaled > 0) ? int(scaled) : 0;
+            return uint16_t((level < max_value) ? level : max_value);
+        }
+
+        // The scalar pipeline, step for step the same as the vector one
+        uint16_t apply(double value, double dither) const
+        {
+            value = value * options.exposure;
+            value = (value > 0) ? value : 0.0;
+
+            if (options.mapper == tone_mapper::reinhard)
+            {
+                value = value / (1.0 + value);
+            }
+            else if (options.mapper == tone_mapper::aces)
+            {
+                value = (value * (2.51 * value + 0.03)) / (value * (2.43 * value + 0.59) + 0.14);
+            }
+
+            double encoded = std::sqrt((value < 1.0) ? value : 1.0);
+            if (options.transfer == transfer_function::srgb)
+            {
+                encoded = srgb_lookup(encoded);
+            }
+            return quantize(encoded, dither);
+        }
+
+#if defined(__AVX__)
+        static __m256d load4(const double* samples)
+        {
+            return _mm256_loadu_pd(samples);
+        }
+
+        static __m256d load4(const float* samples)
+        {
+            return _mm256_cvtps_pd(_mm_loadu_ps(samples));
+        }
+#endif
+};
+
+#endif
@@ -3,35 +3,75 @@
 
 #include "rtweekend.h"
 
-class vec3
+// Three doubles padded to four and aligned, so with AVX a vector fills exactly one register and
+// the arithmetic below runs on whole registers. Without AVX (portable builds, or RT_VEC3_SCALAR
+// defined) the same functions fall back to plain scalar code. The padding lane is kept out of
+// every result that is read back.
+#if defined(__AVX__) && !defined(RT_VEC3_SCALAR)
+#define RT_VEC3_AVX
+#include <immintrin.h>
+#endif
+
+#if defined(RT_VEC3_AVX)
+#define RT_VEC3_ALIGNMENT 32
+#else
+#define RT_VEC3_ALIGNMENT 16
+#endif
+
+class alignas(RT_VEC3_ALIGNMENT) vec3
 {
     public:
-        double components[3]; // Holds x, y, z components
-
-        vec3() : components{0, 0, 0} {}
-        vec3(double x, double y, double z) : components{x, y, z} {}
+        double components[4]; // Holds x, y, z components, then padding
+
+#if defined(RT_VEC3_AVX)
+        // Written as one full-width store: assembling a vector from separate scalar stores and
+        // reading it back as a register stalls store-to-load forwarding.
+        vec3() { _mm256_store_pd(components, _mm256_setzero_pd()); }
+        vec3(double x, double y, double z) { _mm256_store_pd(components, _mm256_set_pd(0, z, y, x)); }
+        explicit vec3(__m256d values) { _mm256_store_pd(components, values); }
+        __m256d lanes() const { return _mm256_load_pd(components); }
+#else
+        vec3() : components{0, 0, 0, 0} {}
+        vec3(double x, double y, double z) : components{x, y, z, 0} {}
+#endif
 
         double get_x() const { return components[0]; }
         double get_y() const { return components[1]; }
         double get_z() const { return components[2]; }
 
-        vec3 operator-() const { return vec3(-components[0], -components[1], -components[2]); }
+        vec3 operator-() const
+        {
+#if defined(RT_VEC3_AVX)
+            return vec3(_mm256_xor_pd(lanes(), _mm256_set1_pd(-0.0)));
+#else
+            return vec3(-components[0], -components[1], -components[2]);
+#endif
+        }
+
         double operator[](int index) const { return components[index]; }
         double& operator[](int index) { return components[index]; }
 
         vec3& operator += (const vec3& vector)
         {
+#if defined(RT_VEC3_AVX)
+            _mm256_store_pd(components, _mm256_add_pd(lanes(), vector.lanes()));
+#else
             components[0] += vector.components[0];
             components[1] += vector.components[1];
             components[2] += vector.components[2];
+#endif
             return *this;
         }
 
         vec3& operator *= (double scalar)
         {
+#if defined(RT_VEC3_AVX)
+            _mm256_store_pd(components, _mm256_mul_pd(lanes(), _mm256_set1_pd(scalar)));
+#else
             components[0] *= scalar;
             components[1] *= scalar;
             components[2] *= scalar;
+#endif
             return *this;
         }
 
@@ -45,10 +85,7 @@ class vec3
             return std::sqrt(get_length_squared());
         }
 
-        double get_length_squared() const
-        {
-            return components[0]*components[0] + components[1]*components[1] + components[2]*components[2];
-        }
+        double get_length_squared() const;
 
         bool near_zero() const
         {
@@ -58,18 +95,10 @@ class vec3
                 && (std::fabs(components[1]) < threshold)
                 && (std::fabs(components[2]) < threshold);
         }
-
-        static vec3 get_random()
-        {
-            return vec3(random_double(), random_double(), random_double());
-        }
-
-        static vec3 get_random(double min, double max)
-        {
-            return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
-        }
 };
 
+static_assert(sizeof(vec3) == 32, "vec3 must stay four doubles wide");
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 
@@ -85,33 +114,49 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& vector)
 // Add two vectors component-wise
 inline vec3 operator+(const vec3& vector1, const vec3& vector2)
 {
+#if defined(RT_VEC3_AVX)
+    return vec3(_mm256_add_pd(vector1.lanes(), vector2.lanes()));
+#else
     return vec3(vector1.components[0] + vector2.components[0],
                 vector1.components[1] + vector2.components[1],
                 vector1.components[2] + vector2.components[2]);
+#endif
 }
 
 // Subtract the second vector from the first component-wise
 inline vec3 operator-(const vec3& vector1, const vec3& vector2)
 {
+#if defined(RT_VEC3_AVX)
+    return vec3(_mm256_sub_pd(vector1.lanes(), vector2.lanes()));
+#else
     return vec3(vector1.components[0] - vector2.components[0],
                 vector1.components[1] - vector2.components[1],
                 vector1.components[2] - vector2.components[2]);
+#endif
 }
 
 // Multiply two vectors component-wise
 inline vec3 operator*(const vec3& vector1, const vec3& vector2)
 {
+#if defined(RT_VEC3_AVX)
+    return vec3(_mm256_mul_pd(vector1.lanes(), vector2.lanes()));
+#else
     return vec3(vector1.components[0] * vector2.components[0],
                 vector1.components[1] * vector2.components[1],
                 vector1.components[2] * vector2.components[2]);
+#endif
 }
 
 // Scale a vector by a scalar from the left
 inline vec3 operator*(double scalar, const vec3& vector)
 {
+#if defined(RT_VEC3_AVX)
+    return vec3(_mm256_mul_pd(_mm256_set1_pd(scalar), vector.lanes()));
+#else
     return vec3(scalar * vector.components[0],
                 scalar * vector.components[1],
                 scalar * vector.components[2]);
+#endif
 }
 
 // Scale a vector by a scalar from the right
@@ -129,6 +174,8 @@ inline vec3 operator/(const vec3& vector, double scalar)
 // Compute the dot product of two vectors
 inline double dot(const vec3& vector1, const vec3& vector2)
 {
+    // Kept scalar on purpose: a horizontal sum inside one register costs more than three loads,
+    // and in loops the compiler can vectorize the scalar form across iterations instead
     return vector1.components[0] * vector2.components[0]
          + vector1.components[1] * vector2.components[1]
          + vector1.components[2] * vector2.components[2];
@@ -137,53 +184,29 @@ inline double dot(const vec3& vector1, const vec3& vector2)
 // Compute the cross product of two vectors
 inline vec3 cross(const vec3& vector1, const vec3& vector2)
 {
+#if defined(RT_VEC3_AVX) && defined(__AVX2__)
+    // (y, z, x) * (z, x, y) - (z, x, y) * (y, z, x), padding lane last
+    __m256d a_yzx = _mm256_permute4x64_pd(vector1.lanes(), _MM_SHUFFLE(3, 0, 2, 1));
+    __m256d a_zxy = _mm256_permute4x64_pd(vector1.lanes(), _MM_SHUFFLE(3, 1, 0, 2));
+    __m256d b_yzx = _mm256_permute4x64_pd(vector2.lanes(), _MM_SHUFFLE(3, 0, 2, 1));
+    __m256d b_zxy = _mm256_permute4x64_pd(vector2.lanes(), _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3(_mm256_sub_pd(_mm256_mul_pd(a_yzx, b_zxy), _mm256_mul_pd(a_zxy, b_yzx)));
+#else
     return vec3(vector1.components[1] * vector2.components[2] - vector1.components[2] * vector2.components[1],
                 vector1.components[2] * vector2.components[0] - vector1.components[0] * vector2.components[2],
                 vector1.components[0] * vector2.components[1] - vector1.components[1] * vector2.components[0]);
+#endif
 }
 
-// Compute the unit vector (normalize the input vector)
-inline vec3 unit_vector(const vec3& vector)
+inline double vec3::get_length_squared() const
 {
-    return vector / vector.get_length();
-}
-
-inline vec3 random_in_unit_disk()
-{
-    while (true)
-    {
-        auto point = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (point.get_length_squared() < 1)
-        {
-            return point;
-        }
-    }
-}
-
-inline vec3 random_unit_vector()
-{
-    while (true)
-    {
-        auto random_point = vec3::get_random(-1, 1);
-        auto squared_length = random_point.get_length_squared();
-        if (1e-160 < squared_length && squared_length <= 1)
-        {
-            return random_point / sqrt(squared_length);
-        }
-    }
+    return dot(*this, *this);
 }
 
-inline vec3 random_on_hemisphere(const vec3& normal)
+// Compute the unit vector (normalize the input vector)
+inline vec3 unit_vector(const vec3& vector)
 {
-    vec3 on_unit_sphere = random_unit_vector();
-    if (dot(on_unit_sphere, normal) > 0.0)// In the same hemisphere as the normal
-    {
-        return on_unit_sphere;
-    }
-    else
-    {
-        return -on_unit_sphere;
-    }
+    return vector / vector.get_length();
 }
 
 inline vec3 reflect(const vec3& vector, const vec3& normal)
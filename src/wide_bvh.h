@@ -0,0 +1,489 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "ray_packet.h"
+#include "rtweekend.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Node of an N-wide BVH. The bounds of all N children are stored as structure-of-arrays, so one
+// SIMD kernel can slab-test every child against a ray at once. Unused slots have inverted
+// (empty) bounds and never report a hit.
+template <int N>
+struct alignas(64) wide_bvh_node
+{
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    uint32_t child[N];      // Interior child: node index. Leaf child: first primitive.
+    uint16_t count[N];      // Leaf child: primitive count. 0 for interior children and empty slots.
+};
+
+// Per-ray data shared by every node test: float origin and reciprocal direction, plus which
+// bound is the near plane on each axis. Rounding the origin to float can move it by half an ulp,
+// which for a distant origin is far more than float_far_scale covers, so the origin is widened
+// by a whole ulp: towards the near planes, which can only shorten the entry distances, and away
+// from the far planes, which can only lengthen the exit distances. A grazing ray then never
+// culls a box its double-precision origin enters.
+struct wide_bvh_ray
+{
+    float near_origin[3];       // Origin for distances to the near planes
+    float far_origin[3];        // Origin for distances to the far planes
+    float inverse_direction[3];
+    bool direction_is_negative[3];
+
+    explicit wide_bvh_ray(const ray& r)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float origin = float(r.get_origin()[axis]);
+            float ulp = float_rounding_error(origin);
+            direction_is_negative[axis] = r.direction_is_negative(axis);
+            near_origin[axis] = direction_is_negative[axis] ? origin - ulp : origin + ulp;
+            far_origin[axis] = direction_is_negative[axis] ? origin + ulp : origin - ulp;
+            inverse_direction[axis] = float(r.get_inverse_direction()[axis]);
+        }
+    }
+};
+
+// Slab test of all N children of a node. Writes each child's entry distance to t_near and returns
+// a bitmask of the children whose box overlaps [t_min, t_max]. As in linear_bvh, each exit
+// distance is scaled by float_far_scale to cover the rounding of the reciprocal, the subtraction
+// and the product, so a grazing ray never culls a box it enters. The max/min operand order makes
+// a NaN slab (zero direction component with the origin on the plane) drop out instead of
+// poisoning the interval.
+template <int N>
+inline int intersect_children(const wide_bvh_node<N>& node, const wide_bvh_ray& r,
+                              float t_min, float t_max, float* t_near)
+{
+    const float* near_x = r.direction_is_negative[0] ? node.max_x : node.min_x;
+    const float* near_y = r.direction_is_negative[1] ? node.max_y : node.min_y;
+    const float* near_z = r.direction_is_negative[2] ? node.max_z : node.min_z;
+    const float* far_x = r.direction_is_negative[0] ? node.min_x : node.max_x;
+    const float* far_y = r.direction_is_negative[1] ? node.min_y : node.max_y;
+    const float* far_z = r.direction_is_negative[2] ? node.min_z : node.max_z;
+
+    const float scale = aabb::float_far_scale;
+    int mask = 0;
+    for (int i = 0; i < N; i++)
+    {
+        float entry = t_min;
+        float exit = t_max;
+        float t;
+        t = (near_x[i] - r.near_origin[0]) * r.inverse_direction[0]; entry = (t > entry) ? t : entry;
+        t = (near_y[i] - r.near_origin[1]) * r.inverse_direction[1]; entry = (t > entry) ? t : entry;
+        t = (near_z[i] - r.near_origin[2]) * r.inverse_direction[2]; entry = (t > entry) ? t : entry;
+        t = (far_x[i] - r.far_origin[0]) * r.inverse_direction[0] * scale;  exit = (t < exit) ? t : exit;
+        t = (far_y[i] - r.far_origin[1]) * r.inverse_direction[1] * scale;  exit = (t < exit) ? t : exit;
+        t = (far_z[i] - r.far_origin[2]) * r.inverse_direction[2] * scale;  exit = (t < exit) ? t : exit;
+
+        t_near[i] = entry;
+        mask |= (entry <= exit) << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE__) || defined(_M_X64)
+template <>
+inline int intersect_children<4>(const wide_bvh_node<4>& node, const wide_bvh_ray& r,
+                                 float t_min, float t_max, float* t_near)
+{
+    // _mm_max_ps / _mm_min_ps return their second operand when either is NaN, so the running
+    // interval always goes second.
+    __m128 entry = _mm_set1_ps(t_min);
+    __m128 exit = _mm_set1_ps(t_max);
+    __m128 scale = _mm_set1_ps(aabb::float_far_scale);
+
+    const float* bounds[2][3] = {{node.min_x, node.min_y, node.min_z}, {node.max_x, node.max_y, node.max_z}};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int negative = r.direction_is_negative[axis];
+        __m128 near_origin = _mm_set1_ps(r.near_origin[axis]);
+        __m128 far_origin = _mm_set1_ps(r.far_origin[axis]);
+        __m128 inverse = _mm_set1_ps(r.inverse_direction[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[negative][axis]), near_origin), inverse);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[1 - negative][axis]), far_origin), inverse);
+        t1 = _mm_mul_ps(t1, scale);
+        entry = _mm_max_ps(t0, entry);
+        exit = _mm_min_ps(t1, exit);
+    }
+
+    _mm_storeu_ps(t_near, entry);
+    return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int intersect_children<8>(const wide_bvh_node<8>& node, const wide_bvh_ray& r,
+                                 float t_min, float t_max, float* t_near)
+{
+    __m256 entry = _mm256_set1_ps(t_min);
+    __m256 exit = _mm256_set1_ps(t_max);
+    __m256 scale = _mm256_set1_ps(aabb::float_far_scale);
+
+    const float* bounds[2][3] = {{node.min_x, node.min_y, node.min_z}, {node.max_x, node.max_y, node.max_z}};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int negative = r.direction_is_negative[axis];
+        __m256 near_origin = _mm256_set1_ps(r.near_origin[axis]);
+        __m256 far_origin = _mm256_set1_ps(r.far_origin[axis]);
+        __m256 inverse = _mm256_set1_ps(r.inverse_direction[axis]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds[negative][axis]), near_origin), inverse);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds[1 - negative][axis]), far_origin), inverse);
+        t1 = _mm256_mul_ps(t1, scale);
+        entry = _mm256_max_ps(t0, entry);
+        exit = _mm256_min_ps(t1, exit);
+    }
+
+    _mm256_storeu_ps(t_near, entry);
+    return _mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+}
+#endif
+
+// BVH with N children per node (BVH4, BVH8), collapsed from the binary build tree by repeatedly
+// opening the largest interior child until a node holds N children. Traversal tests all children
+// of a node in one SIMD step and pushes the ones hit far-to-near, so the nearest is visited next.
+// Primitives is the leaf storage, with the same interface as for linear_bvh.
+template <int N, typename Primitives = hittable_list>
+class wide_bvh final : public hittable
+{
+    static_assert(N >= 2 && N <= 16, "wide_bvh supports 2 to 16 children per node");
+
+    public:
+        // Takes over the primitives and reorders them into leaf order
+        wide_bvh(Primitives primitive_set, const bvh_build_options& build_options = bvh_build_options(),
+                 thread_pool* pool = nullptr)
+            : primitives(std::move(primitive_set)), traversal_cost(build_options.traversal_cost)
+        {
+            std::vector<aabb> boxes(primitives.size());
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                boxes[i] = primitives.bounding_box(i);
+            }
+
+            // The build tree only lives until it has been flattened
+            arena build_nodes;
+            bvh_build_result tree = bvh_builder(build_options, pool).build(boxes, build_nodes);
+            primitives.reorder(tree.primitive_order);
+
+            if (tree.root)
+            {
+                nodes.reserve(tree.node_count / (N - 1) + 1);
+                collapse(*tree.root);
+                bbox = tree.root -> box;
+            }
+        }
+
+        bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+        {
+            if (nodes.empty())
+            {
+                return false;
+            }
+
+            wide_bvh_ray traversal_ray(r);
+            stack_entry stack[stack_capacity];
+            int stack_size = 0;
+            stack[stack_size++] = {0, 0, -std::numeric_limits<float>::infinity()};
+            bool hit_anything = false;
+
+            while (stack_size > 0)
+            {
+                stack_entry entry = stack[--stack_size];
+                if (entry.t_near > ray_t.max)
+                {
+                    continue;   // Something closer was hit after this entry was pushed
+                }
+
+                if (entry.count > 0)
+                {
+                    if (primitives.hit_range(r, ray_t, entry.index, entry.count, rec))
+                    {
+                        hit_anything = true;
+                    }
+                    continue;
+                }
+
+                const wide_bvh_node<N>& node = nodes[entry.index];
+                alignas(32) float t_near[N];
+                int mask = intersect_children<N>(node, traversal_ray, float(ray_t.min),
+                                                 float(ray_t.max) * aabb::float_far_scale, t_near);
+
+                // Push hit children sorted far-to-near so the nearest is popped first
+                int first = stack_size;
+                while (mask)
+                {
+                    int i = lowest_bit(mask);
+                    mask &= mask - 1;
+
+                    stack_entry child = {node.child[i], node.count[i], t_near[i]};
+                    int slot = stack_size++;
+                    while (slot > first && stack[slot - 1].t_near < child.t_near)
+                    {
+                        stack[slot] = stack[slot - 1];
+                        slot--;
+                    }
+                    stack[slot] = child;
+                }
+            }
+
+            return hit_anything;
+        }
+
+        // Closest hits for a packet of rays through one shared stack. Every stack entry carries
+        // the rays that reached it; a child is first culled against the packet's frustum, then
+        // slab-tested against those rays at once. The packet must be coherent.
+        // Returns the rays whose record got a closer hit.
+        uint64_t intersect_packet(ray_packet& packet) const
+        {
+            uint64_t improved = 0;
+            if (nodes.empty())
+            {
+                return improved;
+            }
+
+            packet_stack_entry stack[stack_capacity];
+            int stack_size = 0;
+            stack[stack_size++] = {0, 0, -std::numeric_limits<float>::infinity(), packet.all_rays()};
+
+            while (stack_size > 0)
+            {
+                packet_stack_entry entry = stack[--stack_size];
+
+                // Drop the rays that have hit something closer since the entry was pushed
+                uint64_t rays = packet.rays_reaching(entry.rays, entry.t_near);
+                if (rays == 0)
+                {
+                    continue;
+                }
+
+                if (entry.count > 0)
+                {
+                    while (rays != 0)
+                    {
+                        int i = lowest_bit(rays);
+                        rays &= rays - 1;
+
+                        interval ray_t(0, packet.t_max[i]);
+                        if (primitives.hit_range(packet.rays[i], ray_t, entry.index, entry.count, packet.records[i]))
+                        {
+                            packet.shrink(i, ray_t.max);
+                            improved |= uint64_t(1) << i;
+                        }
+                    }
+                    continue;
+                }
+
+                // Push the children some ray hits, sorted far-to-near as in intersect()
+                const wide_bvh_node<N>& node = nodes[entry.index];
+                const float* node_min[3] = {node.min_x, node.min_y, node.min_z};
+                const float* node_max[3] = {node.max_x, node.max_y, node.max_z};
+                int candidates = packet.frustum_may_hit<N>(node_min, node_max);
+
+                int first = stack_size;
+                while (candidates)
+                {
+                    int i = lowest_bit(candidates);
+                    candidates &= candidates - 1;
+                    if (node.child[i] == empty_slot)
+                    {
+                        continue;
+                    }
+
+                    float bounds_min[3] = {node.min_x[i], node.min_y[i], node.min_z[i]};
+                    float bounds_max[3] = {node.max_x[i], node.max_y[i], node.max_z[i]};
+                    float t_near;
+                    uint64_t child_rays = packet.intersect_box(bounds_min, bounds_max, rays, t_near);
+                    if (child_rays == 0)
+                    {
+                        continue;
+                    }
+
+                    packet_stack_entry child = {node.child[i], node.count[i], t_near, child_rays};
+                    int slot = stack_size++;
+                    while (slot > first && stack[slot - 1].t_near < child.t_near)
+                    {
+                        stack[slot] = stack[slot - 1];
+                        slot--;
+                    }
+                    stack[slot] = child;
+                }
+            }
+
+            return improved;
+        }
+
+        aabb bounding_box() const override
+        {
+            return bbox;
+        }
+
+        size_t node_count() const
+        {
+            return nodes.size();
+        }
+
+        const Primitives& leaf_primitives() const
+        {
+            return primitives;
+        }
+
+        // Expected cost of tracing a ray through the finished tree under the surface area
+        // heuristic, comparable with linear_bvh::sah_cost: each node costs traversal_cost for its
+        // one N-wide test and each leaf one unit per primitive, weighted by the probability that
+        // a ray hitting the root also hits the box of the node or leaf.
+        double sah_cost() const
+        {
+            double root_area = bbox.surface_area();
+            if (nodes.empty() || root_area <= 0)
+            {
+                return 0;
+            }
+
+            double cost = traversal_cost;   // The root is tested by every ray
+            for (const auto& node : nodes)
+            {
+                for (int i = 0; i < N; i++)
+                {
+                    if (node.child[i] == empty_slot)
+                    {
+                        continue;
+                    }
+
+                    double weight = (node.count[i] > 0) ? node.count[i] : traversal_cost;
+                    cost += weight * slot_area(node, i) / root_area;
+                }
+            }
+            return cost;
+        }
+
+    private:
+        static constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+        static constexpr int stack_capacity = (N - 1) * bvh_builder::max_depth + 1;
+
+        struct stack_entry
+        {
+            uint32_t index;
+            uint32_t count;     // > 0: leaf primitive range starting at index
+            float t_near;
+        };
+
+        struct packet_stack_entry
+        {
+            uint32_t index;
+            uint32_t count;     // > 0: leaf primitive range starting at index
+            float t_near;       // Nearest entry distance among the rays
+            uint64_t rays;      // The packet's rays that hit this entry's box
+        };
+
+        std::vector<wide_bvh_node<N>> nodes;
+        Primitives primitives;      // In leaf order
+        aabb bbox;
+        double traversal_cost;      // From the build options, for sah_cost
+
+        static double slot_area(const wide_bvh_node<N>& node, int i)
+        {
+            double dx = double(node.max_x[i]) - node.min_x[i];
+            double dy = double(node.max_y[i]) - node.min_y[i];
+            double dz = double(node.max_z[i]) - node.min_z[i];
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+
+        // Emit a wide node for the binary subtree rooted at build_node and return its index
+        uint32_t collapse(const bvh_build_node& build_node)
+        {
+            // Gather up to N children by opening the interior child with the largest surface area
+            const bvh_build_node* children[N];
+            int child_count = 0;
+
+            if (build_node.is_leaf())
+            {
+                children[child_count++] = &build_node;
+            }
+            else
+            {
+                children[child_count++] = build_node.children[0];
+                children[child_count++] = build_node.children[1];
+
+                while (child_count < N)
+                {
+                    int largest = -1;
+                    double largest_area = -1;
+                    for (int i = 0; i < child_count; i++)
+                    {
+                        if (!children[i] -> is_leaf() && children[i] -> box.surface_area() > largest_area)
+                        {
+                            largest = i;
+                            largest_area = children[i] -> box.surface_area();
+                        }
+                    }
+
+                    if (largest < 0)
+                    {
+                        break;
+                    }
+
+                    const bvh_build_node* opened = children[largest];
+                    children[largest] = opened -> children[0];
+                    children[child_count++] = opened -> children[1];
+                }
+            }
+
+            uint32_t node_index = uint32_t(nodes.size());
+            nodes.emplace_back();
+
+            wide_bvh_node<N> node;
+            for (int i = 0; i < N; i++)
+            {
+                if (i >= child_count)
+                {
+                    node.min_x[i] = node.min_y[i] = node.min_z[i] = std::numeric_limits<float>::infinity();
+                    node.max_x[i] = node.max_y[i] = node.max_z[i] = -std::numeric_limits<float>::infinity();
+                    node.child[i] = empty_slot;
+                    node.count[i] = 0;
+                    continue;
+                }
+
+                const aabb& box = children[i] -> box;
+                node.min_x[i] = float_round_down(box.x.min);
+                node.min_y[i] = float_round_down(box.y.min);
+                node.min_z[i] = float_round_down(box.z.min);
+                node.max_x[i] = float_round_up(box.x.max);
+                node.max_y[i] = float_round_up(box.y.max);
+                node.max_z[i] = float_round_up(box.z.max);
+
+                if (children[i] -> is_leaf())
+                {
+                    node.child[i] = uint32_t(children[i] -> first);
+                    node.count[i] = uint16_t(children[i] -> count);
+                }
+                else
+                {
+                    node.child[i] = collapse(*children[i]);
+                    node.count[i] = 0;
+                }
+            }
+
+            nodes[node_index] = node;
+            return node_index;
+        }
+};
+
+template <typename Primitives = hittable_list>
+using bvh4 = wide_bvh<4, Primitives>;
+
+template <typename Primitives = hittable_list>
+using bvh8 = wide_bvh<8, Primitives>;
+
+#endif